@@ -1,5 +1,11 @@
 if [ $1 = hash ]; then
-    echo "EMME_COMMIT_HASH=\"$(git rev-parse HEAD)\""
+    # git of the source tree, whichever directory the build runs in
+    cd "$(dirname "$0")"
+    # -dirty when tracked files differ from the commit, nothing without git
+    if hash=$(git rev-parse HEAD 2>/dev/null); then
+        git diff --quiet HEAD -- || hash=$hash-dirty
+    fi
+    echo "EMME_COMMIT_HASH=\"$hash\""
 fi
 if [ $1 = time ]; then
     echo "EMME_BUILD_DATE=\"$(date -I'sec')\""
@@ -0,0 +1,82 @@
+#ifndef ASYNC_FILE_WRITER_H
+#define ASYNC_FILE_WRITER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Binary file written by a background thread, so that solvers do not
+ * wait for the file system.
+ *
+ * Two buffers of BUFFER_SIZE are used in turn: the caller fills one while
+ * the other is being written, and only waits when it fills up before the
+ * last one is done. Large writes are cut to fit, so that memory stays at
+ * two buffers however large a write is. Optionally the file is gzip
+ * compressed (needs EMME_ZLIB).
+ */
+class AsyncFileWriter {
+   public:
+    // ".gz" is appended to the name of compressed file
+    AsyncFileWriter(std::string file_name, bool compress = false);
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    template <typename T>
+    void write(const T* data, std::size_t n) {
+        auto bytes = reinterpret_cast<const char*>(data);
+        auto remaining = n * sizeof(T);
+        while (remaining != 0) {
+            const auto chunk =
+                std::min(remaining, BUFFER_SIZE - filling.size());
+            filling.insert(filling.end(), bytes, bytes + chunk);
+            bytes += chunk;
+            remaining -= chunk;
+            if (filling.size() >= BUFFER_SIZE) { hand_over(); }
+        }
+    }
+
+    // Discard everything written so far, a failed write before still counts
+    void truncate();
+
+    // Wait until everything is in file
+    void flush();
+
+    // False if file can not be opened or some write failed, call flush first
+    // to include the writes still in buffers
+    explicit operator bool() const;
+
+    // Name of the file actually written
+    const std::string& file_name() const {
+        return name;
+    }
+
+   private:
+    static constexpr std::size_t BUFFER_SIZE = 4 << 20;
+
+    std::string name;
+    bool compress;
+    void* file{};
+    bool failed{};
+
+    std::vector<char> filling;
+    std::vector<char> writing;
+    bool has_writing{};
+    bool should_terminate{};
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::thread writer;
+
+    void open();
+    void close();
+    void hand_over();
+    void write_loop();
+};
+
+#endif  // ASYNC_FILE_WRITER_H
@@ -1,11 +1,21 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include <future>   //unique_lock, packaged_task
-#include <mutex>    // mutex
-#include <queue>    // deque
-#include <thread>   // hardware_concurrency
-#include <utility>  // move
+#include <algorithm>    // max
+#include <atomic>       // atomic, atomic_thread_fence
+#include <cstddef>      // max_align_t
+#include <cstdint>      // int64_t, uint32_t
+#include <exception>    // exception_ptr
+#include <future>       // packaged_task
+#include <memory>       // unique_ptr
+#include <mutex>        // mutex
+#include <new>          // placement new
+#include <optional>     // optional
+#include <queue>        // queue
+#include <thread>       // hardware_concurrency
+#include <type_traits>  // decay_t
+#include <utility>      // move, pair
+#include <vector>       // vector
 
 /**
  * @brief A thread pool managing a bunch of threads and a queue of tasks. It can
@@ -13,6 +23,21 @@
  * threads in destruction. During its lifetime, it can accepts and dispatch
  * tasks to those threads.
  *
+ * Every worker owns a lock-free work-stealing deque, tasks submitted by a
+ * worker go to its own deque. Every other submitting thread gets a deque of
+ * its own on first submission, so submission never takes a lock or contends
+ * with other submitters. Idle workers steal from the top of all deques and
+ * sleep on an atomic epoch, which is only notified when some worker sleeps.
+ *
+ * queue_task returns a future for each task. Loops over an index range
+ * should use parallel_for / parallel_reduce instead, which split the range
+ * only when some worker is idle to take the other half, and keep their
+ * tasks on the stack so that submission does not allocate.
+ *
+ * for_each_worker runs a function once on every worker, through an inbox of
+ * the worker which others do not steal from, e.g. to pin workers or to
+ * process worker_block of a range on the same worker every time.
+ *
  * @tparam T The return type of tasks
  */
 template <typename T>
@@ -21,60 +46,277 @@ class DedicatedThreadPool {
     using lock_type = std::unique_lock<std::mutex>;
     using task_type = std::packaged_task<T()>;
 
+   private:
+    /**
+     * @brief Unfinished task number of a join point, and the first exception
+     * thrown by its tasks.
+     *
+     */
+    class task_counter {
+       public:
+        void add(int n) {
+            pending.fetch_add(n, std::memory_order_relaxed);
+        }
+        int load() const {
+            return pending.load(std::memory_order_acquire);
+        }
+        void wait(int p) const {
+            pending.wait(p, std::memory_order_acquire);
+        }
+        void set_exception(std::exception_ptr e) {
+            if (!failed.test_and_set(std::memory_order_acq_rel)) {
+                error = std::move(e);
+            }
+        }
+        void finish() {
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                pending.notify_all();
+            }
+        }
+        // Rethrow the first exception and forget it, all tasks must be done
+        void rethrow() {
+            if (error) {
+                auto e = std::move(error);
+                error = nullptr;
+                failed.clear();
+                std::rethrow_exception(e);
+            }
+        }
+
+       private:
+        std::atomic<int> pending{};
+        std::atomic_flag failed{};
+        std::exception_ptr error;
+    };
+
+    /**
+     * @brief Type-erased void() task. Callables up to INLINE_SIZE bytes are
+     * stored in place, larger ones on heap. A task of queue_task owns itself
+     * and is deleted after run, others live on the stack of a parallel loop
+     * or for_each_worker and report to its counter.
+     *
+     */
+    class pool_task {
+       public:
+        static constexpr std::size_t INLINE_SIZE = 64;
+
+        template <typename Func>
+        pool_task(Func&& func, task_counter* counter_) : counter(counter_) {
+            using F = std::decay_t<Func>;
+            if constexpr (sizeof(F) <= INLINE_SIZE &&
+                          alignof(F) <= alignof(std::max_align_t)) {
+                new (storage) F(std::forward<Func>(func));
+                invoke = [](void* p) { (*static_cast<F*>(p))(); };
+                destroy = [](void* p) { static_cast<F*>(p)->~F(); };
+            } else {
+                new (storage) F*(new F(std::forward<Func>(func)));
+                invoke = [](void* p) { (**static_cast<F**>(p))(); };
+                destroy = [](void* p) { delete *static_cast<F**>(p); };
+            }
+        }
+        ~pool_task() {
+            destroy(storage);
+        }
+        pool_task(const pool_task&) = delete;
+        pool_task& operator=(const pool_task&) = delete;
+
+        // The task may be gone when this returns
+        void run() {
+            if (!counter) {
+                // packaged_task keeps exception in future
+                invoke(storage);
+                delete this;
+                return;
+            }
+            auto c = counter;
+            try {
+                invoke(storage);
+            } catch (...) { c->set_exception(std::current_exception()); }
+            c->finish();
+        }
+
+        // Left in queue when pool is destroyed
+        void discard() {
+            if (!counter) { delete this; }
+        }
+
+        // next one in a worker inbox
+        pool_task* next{};
+
+       private:
+        alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+        void (*invoke)(void*);
+        void (*destroy)(void*);
+        task_counter* counter;
+    };
+
     /**
-     * @brief A queue of tasks that can be stolen from. Tasks are pushed and
-     * popped in back, and being stolen from front.
+     * @brief Chase-Lev deque of tasks (Le et al., PPoPP 2013). Only its owner
+     * pushes and pops at bottom, others steal from top by CAS, none takes a
+     * lock. The ring buffer grows when full, and old buffers are kept until
+     * destruction since a thief may still be reading them.
      *
      */
-    struct shared_working_queue {
+    struct work_stealing_deque {
        public:
 #ifdef EMME_TRACE
-        size_t submitted{};
-        size_t executed{};
-        size_t stolen{};
-        size_t stealing{};
+        std::atomic<size_t> submitted{};
+        std::atomic<size_t> executed{};
+        std::atomic<size_t> stolen{};
+        std::atomic<size_t> stealing{};
 #endif
 
-        shared_working_queue() = default;
-        void push(task_type&& task) {
-            lock_type lk(deq_mutex);
+        work_stealing_deque() {
+            buffers.emplace_back(new ring_buffer(INITIAL_CAPACITY));
+            ring.store(buffers.back().get(), std::memory_order_relaxed);
+        }
+        ~work_stealing_deque() {
+            const auto r = ring.load(std::memory_order_relaxed);
+            const auto b = bottom.load(std::memory_order_relaxed);
+            for (auto i = top.load(std::memory_order_relaxed); i < b; ++i) {
+                r->get(i)->discard();
+            }
+        }
+        work_stealing_deque(const work_stealing_deque&) = delete;
+        work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+        // owner only
+        void push(pool_task* task) {
+            const auto b = bottom.load(std::memory_order_relaxed);
+            const auto t = top.load(std::memory_order_acquire);
+            auto r = ring.load(std::memory_order_relaxed);
+            if (b - t > r->mask) { r = grow(r, t, b); }
+            r->put(b, task);
+            bottom.store(b + 1, std::memory_order_release);
 #ifdef EMME_TRACE
-            ++submitted;
+            submitted.fetch_add(1, std::memory_order_relaxed);
 #endif
-            deq.push_back(std::move(task));
         }
-        bool try_pop(task_type& task) {
-            lock_type lk(deq_mutex);
-            if (deq.empty()) { return false; }
-            task = std::move(deq.front());
-            deq.pop_front();
+        // owner only, nullptr if empty
+        pool_task* pop() {
+            const auto b = bottom.load(std::memory_order_relaxed) - 1;
+            const auto r = ring.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            auto task = r->get(b);
+            if (t == b) {
+                // the last one, thieves may take it first
+                if (!top.compare_exchange_strong(t, t + 1,
+                                                 std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed)) {
+                    task = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
 #ifdef EMME_TRACE
-            ++executed;
+            if (task) { executed.fetch_add(1, std::memory_order_relaxed); }
 #endif
-            return true;
+            return task;
         }
-        bool try_steal(task_type& task) {
-            lock_type lk(deq_mutex);
-            if (deq.empty()) { return false; }
-            task = std::move(deq.front());
-            deq.pop_front();
+        // any thread, nullptr if empty
+        pool_task* steal() {
+            while (true) {
+                auto t = top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const auto b = bottom.load(std::memory_order_acquire);
+                if (t >= b) { return nullptr; }
+                auto task = ring.load(std::memory_order_acquire)->get(t);
+                if (top.compare_exchange_strong(t, t + 1,
+                                                std::memory_order_seq_cst,
+                                                std::memory_order_relaxed)) {
 #ifdef EMME_TRACE
-            ++stolen;
+                    stolen.fetch_add(1, std::memory_order_relaxed);
 #endif
-            return true;
+                    return task;
+                }
+            }
         }
         bool empty() const {
-            bool empty_;
-            {
-                lock_type lk(deq_mutex);
-                empty_ = deq.empty();
-            }
-            return empty_;
+            return top.load(std::memory_order_acquire) >=
+                   bottom.load(std::memory_order_acquire);
         }
 
        private:
-        std::deque<task_type> deq;
-        mutable std::mutex deq_mutex;
+        static constexpr std::int64_t INITIAL_CAPACITY = 256;
+
+        struct ring_buffer {
+            // capacity - 1, capacity is a power of 2
+            std::int64_t mask;
+            std::unique_ptr<std::atomic<pool_task*>[]> slots;
+
+            ring_buffer(std::int64_t capacity)
+                : mask(capacity - 1),
+                  slots(new std::atomic<pool_task*>[capacity]) {}
+            pool_task* get(std::int64_t i) const {
+                return slots[i & mask].load(std::memory_order_acquire);
+            }
+            void put(std::int64_t i, pool_task* task) {
+                slots[i & mask].store(task, std::memory_order_release);
+            }
+        };
+
+        alignas(64) std::atomic<std::int64_t> top{};
+        alignas(64) std::atomic<std::int64_t> bottom{};
+        alignas(64) std::atomic<ring_buffer*> ring{};
+        // owner only
+        std::vector<std::unique_ptr<ring_buffer>> buffers;
+
+        ring_buffer* grow(ring_buffer* r, std::int64_t t, std::int64_t b) {
+            buffers.emplace_back(new ring_buffer(2 * (r->mask + 1)));
+            auto bigger = buffers.back().get();
+            for (auto i = t; i < b; ++i) { bigger->put(i, r->get(i)); }
+            ring.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+    };
+
+    /**
+     * @brief Tasks for one worker only, a lock-free stack which any thread
+     * pushes to and only the worker pops from. A popped task is not pushed
+     * again before it has run, so popping is free of ABA.
+     *
+     */
+    struct worker_inbox {
+        alignas(64) std::atomic<pool_task*> head{};
+
+        void push(pool_task* task) {
+            task->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(task->next, task,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {}
+        }
+        // owner only, nullptr if empty
+        pool_task* pop() {
+            auto task = head.load(std::memory_order_acquire);
+            while (task && !head.compare_exchange_weak(
+                               task, task->next, std::memory_order_acquire,
+                               std::memory_order_acquire)) {}
+            return task;
+        }
+    };
+
+    /**
+     * @brief Deque of a thread which is not a worker, owned by the thread
+     * until it exits. Workers steal from it whether it is claimed or not.
+     *
+     */
+    struct submitter_slot {
+        work_stealing_deque deq;
+        std::atomic<bool> claimed{};
+    };
+
+    // Release slot of a submitting thread when it exits
+    struct submitter_claim {
+        submitter_slot* slot{};
+
+        ~submitter_claim() {
+            if (slot) { slot->claimed.store(false, std::memory_order_release); }
+        }
     };
 
     /**
@@ -87,7 +329,11 @@ class DedicatedThreadPool {
         auto t_num = num == 0 ? DEFAULT_THREAD_NUM : num;
         try {
             for (size_t i = 0; i < t_num; i++) {
-                worker_queues.emplace_back(new shared_working_queue{});
+                worker_queues.emplace_back(new work_stealing_deque{});
+                worker_inboxes.emplace_back(new worker_inbox{});
+            }
+            for (size_t i = 0; i < MAX_SUBMITTER_NUM; i++) {
+                submitter_slots.emplace_back(new submitter_slot{});
             }
             for (size_t i = 0; i < t_num; i++) {
                 threads.emplace_back(&DedicatedThreadPool::thread_loop, this,
@@ -99,8 +345,7 @@ class DedicatedThreadPool {
 #endif
         } catch (...) {  // in this case dtor is not called, so threads
                          // termination should be proper handled here
-            should_terminate = true;
-            cv.notify_all();
+            terminate_threads();
             throw;
         }
     }
@@ -109,8 +354,7 @@ class DedicatedThreadPool {
     using return_type = T;
 
     ~DedicatedThreadPool() {
-        should_terminate = true;
-        cv.notify_all();
+        terminate_threads();
 
 #ifdef EMME_TRACE
         std::cout << "\n[DEBUG] The thread pool has " << thread_num()
@@ -135,30 +379,113 @@ class DedicatedThreadPool {
      */
     template <typename Func>
     std::future<return_type> queue_task(Func func) {
-        task_type task(std::move(func));
-        auto res = task.get_future();
-        {
-            lock_type lk(main_queue_mutex);
-            main_queue.push(std::move(task));
-#ifdef EMME_TRACE
-            ++submitted;
-#endif
-        }
-        cv.notify_one();
+        task_type packaged(std::move(func));
+        auto res = packaged.get_future();
+        submit(new pool_task(std::move(packaged), nullptr));
         return res;
     }
 
+    /**
+     * @brief Call f(b, e) on pieces [b, e) of [begin, end), no longer than
+     * grain, and return when all are done. The range is halved (the half
+     * left in the queue of the calling thread for others to steal) only when
+     * that queue is empty, that is when the last half handed out has been
+     * taken, so idle workers get big pieces and busy ones split no further.
+     * The calling thread takes part in the work while waiting. The first
+     * exception thrown by f is rethrown.
+     */
+    template <typename Index, typename Func>
+    void parallel_for(Index begin, Index end, Index grain, const Func& f) {
+        if (begin >= end) { return; }
+        for_range(begin, end, std::max(grain, Index{1}), f);
+    }
+
+    /**
+     * @brief Reduce [begin, end) by acc = f(b, e, std::move(acc)) on pieces
+     * of at most grain, starting from identity, and merging results of
+     * halves split as in parallel_for by combine(left, right). Pieces are
+     * combined in index order, but where the range is split depends on
+     * scheduling, so a floating point result may differ in the last bits
+     * between runs.
+     */
+    template <typename Index, typename V, typename Func, typename Combine>
+    V parallel_reduce(Index begin,
+                      Index end,
+                      Index grain,
+                      const V& identity,
+                      const Func& f,
+                      const Combine& combine) {
+        if (begin >= end) { return identity; }
+        return reduce_range(begin, end, std::max(grain, Index{1}), identity,
+                            identity, f, combine);
+    }
+
+    /**
+     * @brief Call f(worker) once on every worker, worker in [0,
+     * thread_num()), and return when all are done. A worker runs it when it
+     * finishes its current task, so this waits for the longest of those.
+     * The calling thread runs tasks of others while waiting. The first
+     * exception thrown by f is rethrown.
+     */
+    template <typename Func>
+    void for_each_worker(const Func& f) {
+        const auto n = thread_num();
+        task_counter done;
+        done.add(static_cast<int>(n));
+        std::vector<std::unique_ptr<pool_task>> tasks;
+        tasks.reserve(n);
+        for (size_t w = 0; w < n; ++w) {
+            tasks.emplace_back(new pool_task([&f, w]() { f(w); }, &done));
+            worker_inboxes[w]->push(tasks.back().get());
+        }
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping_num.load(std::memory_order_seq_cst) != 0) {
+            epoch.notify_all();
+        }
+        while (true) {
+            const int p = done.load();
+            if (p == 0) { break; }
+            pool_task* task = pop_own();
+            if (!task) { task = try_steal_from_others(); }
+            if (task) {
+                task->run();
+            } else {
+                done.wait(p);
+            }
+        }
+        done.rethrow();
+    }
+
+    /**
+     * @brief Part of [begin, end) for worker in for_each_worker, the range
+     * cut into thread_num() contiguous blocks of about the same length.
+     */
+    template <typename Index>
+    std::pair<Index, Index> worker_block(Index begin,
+                                         Index end,
+                                         size_t worker) const {
+        const auto n = thread_num();
+        const auto length = static_cast<size_t>(end - begin);
+        return {begin + static_cast<Index>(length * worker / n),
+                begin + static_cast<Index>(length * (worker + 1) / n)};
+    }
+
     /**
      * @brief Return true if there are no tasks in queue. (But there may be
      * tasks being executing by threads.)
      */
     bool is_main_queue_empty() {
-        bool queue_empty;
-        {
-            lock_type lk(main_queue_mutex);
-            queue_empty = main_queue.empty();
+        if (main_queue_size.load(std::memory_order_acquire) != 0) {
+            return false;
+        }
+        const auto n = submitter_num.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i) {
+            if (!submitter_slots[i]->deq.empty()) { return false; }
         }
-        return queue_empty;
+        for (const auto& q : worker_queues) {
+            if (!q->empty()) { return false; }
+        }
+        return true;
     }
 
     size_t thread_num() const {
@@ -179,7 +506,7 @@ class DedicatedThreadPool {
 
    private:
     static constexpr size_t DEFAULT_THREAD_NUM = 8;
-    static constexpr size_t BATCH_SIZE = 16;
+    static constexpr size_t MAX_SUBMITTER_NUM = 64;
 
     /**
      * @brief Hold a ref of thread vector, use RAII to ensure all the threads is
@@ -200,30 +527,177 @@ class DedicatedThreadPool {
         }
     };
 
-    bool try_pop_from_main(task_type& task) {
-        {
+    submitter_slot* claim_submitter_slot() {
+        for (size_t i = 0; i < submitter_slots.size(); ++i) {
+            bool expected = false;
+            if (submitter_slots[i]->claimed.compare_exchange_strong(
+                    expected, true, std::memory_order_acquire)) {
+                // let workers look this far
+                auto n = submitter_num.load(std::memory_order_relaxed);
+                while (n < i + 1 &&
+                       !submitter_num.compare_exchange_weak(n, i + 1)) {}
+                return submitter_slots[i].get();
+            }
+        }
+        return nullptr;
+    }
+
+    void submit(pool_task* task) {
+        if (worker_queue_ptr) {
+            worker_queue_ptr->push(task);
+        } else if (claim.slot || (claim.slot = claim_submitter_slot())) {
+            claim.slot->deq.push(task);
+        } else {
+            // more submitting threads than slots
             lock_type lk(main_queue_mutex);
-            if (main_queue.empty()) { return false; }
-            size_t c{};
-            while (c++ < BATCH_SIZE && !main_queue.empty()) {
-                worker_queue_ptr->push(std::move(main_queue.front()));
-                main_queue.pop();
+            main_queue.push(task);
+            main_queue_size.fetch_add(1, std::memory_order_release);
+        }
+#ifdef EMME_TRACE
+        submitted.fetch_add(1, std::memory_order_relaxed);
+#endif
+        wake_one();
+    }
+
+    // Task from the inbox or deque of the calling thread, to run while
+    // waiting
+    pool_task* pop_own() {
+        if (worker_queue_ptr) {
+            if (auto task = worker_inboxes[thread_idx]->pop()) { return task; }
+            return worker_queue_ptr->pop();
+        }
+        if (claim.slot) { return claim.slot->deq.pop(); }
+        return nullptr;
+    }
+
+    // Nothing of the calling thread is left for others to steal
+    bool own_queue_empty() const {
+        if (worker_queue_ptr) { return worker_queue_ptr->empty(); }
+        if (claim.slot) { return claim.slot->deq.empty(); }
+        return true;
+    }
+
+    /**
+     * @brief Run right as a task which others may steal and left here, and
+     * return when both are done. The task lives on this stack frame, so
+     * waiting runs own tasks (right itself when not stolen) and steals from
+     * others rather than block.
+     */
+    template <typename Left, typename Right>
+    void fork_join(const Left& left, const Right& right) {
+        task_counter done;
+        done.add(1);
+        pool_task child(right, &done);
+        submit(&child);
+        std::exception_ptr error;
+        try {
+            left();
+        } catch (...) { error = std::current_exception(); }
+        while (true) {
+            const int p = done.load();
+            if (p == 0) { break; }
+            pool_task* task = pop_own();
+            if (!task) { task = try_steal_from_others(); }
+            if (task) {
+                task->run();
+            } else {
+                done.wait(p);
+            }
+        }
+        if (error) { std::rethrow_exception(error); }
+        done.rethrow();
+    }
+
+    template <typename Index, typename Func>
+    void for_range(Index begin, Index end, Index grain, const Func& f) {
+        while (end - begin > grain) {
+            if (own_queue_empty()) {
+                const Index mid = begin + (end - begin) / 2;
+                fork_join([&]() { for_range(begin, mid, grain, f); },
+                          [&]() { for_range(mid, end, grain, f); });
+                return;
             }
+            f(begin, begin + grain);
+            begin += grain;
+        }
+        f(begin, end);
+    }
+
+    template <typename Index, typename V, typename Func, typename Combine>
+    V reduce_range(Index begin,
+                   Index end,
+                   Index grain,
+                   V acc,
+                   const V& identity,
+                   const Func& f,
+                   const Combine& combine) {
+        while (end - begin > grain) {
+            if (own_queue_empty()) {
+                const Index mid = begin + (end - begin) / 2;
+                std::optional<V> right;
+                fork_join(
+                    [&]() {
+                        acc = reduce_range(begin, mid, grain, std::move(acc),
+                                           identity, f, combine);
+                    },
+                    [&]() {
+                        right.emplace(reduce_range(mid, end, grain, identity,
+                                                   identity, f, combine));
+                    });
+                return combine(std::move(acc), std::move(*right));
+            }
+            acc = f(begin, begin + grain, std::move(acc));
+            begin += grain;
+        }
+        return f(begin, end, std::move(acc));
+    }
+
+    void wake_one() {
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping_num.load(std::memory_order_seq_cst) != 0) {
+            epoch.notify_one();
         }
-        return worker_queue_ptr->try_pop(task);
     }
 
-    bool try_steal_from_others(task_type& task) {
-        for (size_t i = 0; i < worker_queues.size() - 1; ++i) {
+    void terminate_threads() {
+        should_terminate.store(true, std::memory_order_release);
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        epoch.notify_all();
+    }
+
+    pool_task* try_pop_from_main() {
+        if (main_queue_size.load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        lock_type lk(main_queue_mutex);
+        if (main_queue.empty()) { return nullptr; }
+        auto task = main_queue.front();
+        main_queue.pop();
+        main_queue_size.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    // Also called by threads other than workers waiting in fork_join
+    pool_task* try_steal_from_others() {
+        for (size_t i = 0; i < worker_queues.size(); ++i) {
             const auto idx = (thread_idx + i + 1) % worker_queues.size();
-            if (worker_queues[idx]->try_steal(task)) {
+            if (worker_queues[idx].get() == worker_queue_ptr) { continue; }
+            if (auto task = worker_queues[idx]->steal()) {
 #ifdef EMME_TRACE
-                ++(worker_queue_ptr->stealing);
+                if (worker_queue_ptr) {
+                    worker_queue_ptr->stealing.fetch_add(
+                        1, std::memory_order_relaxed);
+                }
 #endif
-                return true;
+                return task;
             }
         }
-        return false;
+        const auto n = submitter_num.load(std::memory_order_seq_cst);
+        for (size_t i = 0; i < n; ++i) {
+            const auto idx = (thread_idx + i) % n;
+            if (auto task = submitter_slots[idx]->deq.steal()) { return task; }
+        }
+        return nullptr;
     }
 
     /**
@@ -233,38 +707,50 @@ class DedicatedThreadPool {
     void thread_loop(size_t idx) {
         thread_idx = idx;
         worker_queue_ptr = worker_queues[idx].get();
-        task_type task;
-        // Fetch task from local queue, main queue and other thread's local
-        // queue in order.
-        while (!should_terminate) {
-            if (worker_queue_ptr->try_pop(task) || try_pop_from_main(task) ||
-                try_steal_from_others(task)) {
-                task();
+        // Fetch task from local queue, other threads' queues and main queue
+        // in order.
+        while (!should_terminate.load(std::memory_order_acquire)) {
+            const auto seen = epoch.load(std::memory_order_seq_cst);
+            pool_task* task = pop_own();
+            if (!task) { task = try_steal_from_others(); }
+            if (!task) { task = try_pop_from_main(); }
+            if (task) {
+                task->run();
             } else {
-                lock_type lk(main_queue_mutex);
-                // Wait until there are tasks in main queue (awaked by
-                // notify_one in queue_task), or the thread pool is being
-                // shutdown (awaked by notify_all in destructor)
-                cv.wait(lk, [this] {
-                    return !main_queue.empty() || should_terminate;
-                });
+                // Sleep until some task is queued after the search began
+                // (epoch is bumped by wake_one in queue_task), or the thread
+                // pool is being shutdown
+                sleeping_num.fetch_add(1, std::memory_order_seq_cst);
+                epoch.wait(seen, std::memory_order_seq_cst);
+                sleeping_num.fetch_sub(1, std::memory_order_seq_cst);
             }
         }
     }
 
 #ifdef EMME_TRACE
-    size_t submitted{};
+    std::atomic<size_t> submitted{};
 #endif
-    bool should_terminate = false;  // Tells threads to stop looking for tasks
-    std::mutex main_queue_mutex;    // Protects main task queue
-    std::condition_variable cv;     // Signals for thread sleep/awake
+    // Tells threads to stop looking for tasks
+    std::atomic<bool> should_terminate{};
+    // Bumped on every submission, idle threads wait on it
+    std::atomic<std::uint32_t> epoch{};
+    std::atomic<size_t> sleeping_num{};
     std::vector<std::thread> threads;  // Thread container
 
-    std::queue<task_type> main_queue;  // Main queue for tasks
+    // Overflow of submitter slots
+    std::mutex main_queue_mutex;
+    std::queue<pool_task*> main_queue;
+    std::atomic<size_t> main_queue_size{};
+
     inline static thread_local size_t thread_idx{};
     // Local queue ptr for tasks
-    inline static thread_local shared_working_queue* worker_queue_ptr{};
-    std::vector<std::unique_ptr<shared_working_queue>> worker_queues;
+    inline static thread_local work_stealing_deque* worker_queue_ptr{};
+    inline static thread_local submitter_claim claim{};
+    std::vector<std::unique_ptr<work_stealing_deque>> worker_queues;
+    std::vector<std::unique_ptr<worker_inbox>> worker_inboxes;
+    std::vector<std::unique_ptr<submitter_slot>> submitter_slots;
+    // Slots claimed at least once, [0, submitter_num)
+    std::atomic<size_t> submitter_num{};
 
     JoinThreads join_threads;  // Defined last to ensure destruct first
 };
@@ -5,6 +5,18 @@
 
 template <typename T>
 struct Grid {
+    /**
+     * @brief Geometric quantities at one grid node. The eigen kernel needs
+     * them for every pair of nodes, so they are tabulated once per grid.
+     *
+     */
+    struct NodeGeometry {
+        T eta;
+        T bi;
+        // integral of omega_d along field line, see g_integration_f
+        T g;
+    };
+
     Grid(T leni, unsigned int npointsi)
         : len(leni),
           npoints(npointsi),
@@ -13,10 +25,19 @@ struct Grid {
         for (unsigned int i = 0; i < npoints; i++) { grid[i] = -len + i * dx; }
     }
 
+    // Also tabulate geometry of each node from parameters
+    template <typename Para>
+    Grid(T leni, unsigned int npointsi, const Para& para)
+        : Grid(leni, npointsi) {
+        geometry.reserve(npoints);
+        for (const auto eta : grid) { geometry.push_back(para.geometry(eta)); }
+    }
+
     T len;
     unsigned int npoints;
     T dx;
     std::vector<T> grid;
+    std::vector<NodeGeometry> geometry;
 };
 
 #endif
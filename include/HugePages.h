@@ -0,0 +1,81 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+
+/**
+ * @brief Memory of containers allocated with util::Alignment::HUGE_PAGE. A
+ * block of at least MIN_SIZE bytes is mapped on its own, 2 MiB aligned and
+ * rounded up to whole 2 MiB pages, so that it can be backed by huge pages
+ * and takes fewer TLB entries when streamed through. Smaller blocks, and all
+ * blocks on other systems than Linux, are ordinary 64-byte aligned heap
+ * memory.
+ *
+ * How a block gets huge pages is a process wide policy:
+ *   off          no hint, the kernel may still use transparent huge pages
+ *                if /sys/kernel/mm/transparent_hugepage/enabled is always
+ *   transparent  madvise(MADV_HUGEPAGE), the default, works unless that
+ *                setting is never
+ *   hugetlbfs    mmap(MAP_HUGETLB) from pages reserved in
+ *                /proc/sys/vm/nr_hugepages, falling back to transparent if
+ *                none is left
+ *
+ * Transparent huge pages are not guaranteed, report() looks the blocks still
+ * allocated up in /proc/self/smaps to see how much of them got them. Freeing
+ * a block does not.
+ *
+ * A page is placed on the NUMA node of the thread first writing it. With a
+ * first touch function set, a block mapped on its own and allocated with
+ * first_touch is passed to it before it is returned, so that its pages can be
+ * written by the threads going to work on them rather than by the allocating
+ * thread. That is for long-lived blocks only, as it costs a round through
+ * every worker.
+ */
+class HugePages {
+   public:
+    enum class Policy { off, transparent, hugetlbfs };
+
+    static constexpr std::size_t PAGE_BYTES = std::size_t{1} << 21;
+    static constexpr std::size_t MIN_SIZE = PAGE_BYTES / 2;
+
+    using first_touch_function = void (*)(void* ptr, std::size_t size);
+
+    // bytes of blocks mapped on their own so far
+    struct usage {
+        std::size_t mapped;
+        std::size_t hugetlbfs;
+        std::size_t transparent_advised;
+        // transparent blocks allocated at the call of report() which found
+        // most bytes backed by huge pages, and those bytes
+        std::size_t transparent_sampled;
+        std::size_t transparent_backed;
+    };
+
+    static void set_policy(Policy);
+    static Policy policy() {
+        return current_policy.load(std::memory_order_relaxed);
+    }
+    // throw std::invalid_argument for an unknown name
+    static Policy parse_policy(std::string_view name);
+    static const char* name(Policy);
+
+    // nullptr to leave blocks to be touched by their users
+    static void set_first_touch(first_touch_function);
+
+    // nullptr on failure
+    static void* allocate(std::size_t size, bool first_touch);
+    static void deallocate(void* ptr, std::size_t size) noexcept;
+
+    // Totals, and a sample of blocks still allocated, kept if it finds more
+    // backed than the samples before. Call it while the blocks of interest
+    // are alive, it reads /proc/self/smaps if there are transparent blocks.
+    static usage report();
+
+   private:
+    inline static std::atomic<Policy> current_policy{Policy::transparent};
+    inline static std::atomic<first_touch_function> touch_function{};
+};
+
+#endif  // HUGE_PAGES_H
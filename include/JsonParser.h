@@ -248,8 +248,9 @@ struct Value {
 
     ValueCategory value_category() const;
 
-    // unformatted output
-    std::string dump() const;
+    // unformatted output, floating point numbers with precision significant
+    // digits (17 to read back the same double)
+    std::string dump(int precision = 6) const;
 
     // formatted output
     std::string pretty_print(std::size_t = 0) const;
@@ -0,0 +1,104 @@
+#ifndef MEMORY_ACCOUNT_H
+#define MEMORY_ACCOUNT_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Bytes held by containers of util::AlignedAllocator, added up per
+ * tag of the allocator. Current and peak bytes of every tag are always
+ * counted, which costs two relaxed atomic operations per allocation.
+ *
+ * A window records the peak bytes from its opening to its closing, allocations
+ * of all threads included. Timer opens one for every zone once enable() is
+ * called. At most WINDOW_NUMBER windows are open at the same time, opening
+ * more fails and the caller falls back to sampling current().
+ */
+class MemoryAccount {
+   public:
+    enum Tag : std::size_t {
+        // not tagged, the default of AlignedAllocator
+        other,
+        // matrices of EigenSolver and ContourSolver
+        matrix,
+        // LAPACK work arrays and factors
+        workspace,
+        // cached kernel samples of every pair of grid points
+        kernels,
+        pic_markers,
+        pic_field,
+        TAG_NUMBER
+    };
+    // by tag, the last one for all tags together
+    using bytes = std::array<std::size_t, TAG_NUMBER + 1>;
+    using window_id = std::uint32_t;
+
+    static constexpr std::size_t WINDOW_NUMBER = 64;
+    static constexpr window_id NO_WINDOW = static_cast<window_id>(-1);
+
+    static void allocated(Tag tag, std::size_t size) noexcept {
+        const auto now =
+            counters[tag].current.fetch_add(size, std::memory_order_relaxed) +
+            size;
+        const auto all =
+            counters[TAG_NUMBER].current.fetch_add(size,
+                                                   std::memory_order_relaxed) +
+            size;
+        raise(counters[tag].peak, now);
+        raise(counters[TAG_NUMBER].peak, all);
+        for (auto open = open_windows.load(std::memory_order_relaxed); open;
+             open &= open - 1) {
+            auto& window = windows[std::countr_zero(open)];
+            raise(window[tag], now);
+            raise(window[TAG_NUMBER], all);
+        }
+    }
+    static void deallocated(Tag tag, std::size_t size) noexcept {
+        counters[tag].current.fetch_sub(size, std::memory_order_relaxed);
+        counters[TAG_NUMBER].current.fetch_sub(size,
+                                               std::memory_order_relaxed);
+    }
+
+    static bytes current();
+    // highest current() of every tag so far
+    static bytes peak();
+    // the last one is "total"
+    static const char* name(std::size_t tag);
+
+    // Let Timer record the peak of its zones from now on
+    static void enable();
+    static bool enabled() {
+        return windowing.load(std::memory_order_relaxed);
+    }
+
+    // NO_WINDOW if all windows are open
+    static window_id open_window();
+    // Peak since the window opened
+    static bytes close_window(window_id);
+
+   private:
+    struct counter {
+        std::atomic<std::size_t> current;
+        std::atomic<std::size_t> peak;
+    };
+    using atomic_bytes = std::array<std::atomic<std::size_t>, TAG_NUMBER + 1>;
+
+    static void raise(std::atomic<std::size_t>& peak,
+                      std::size_t value) noexcept {
+        auto old = peak.load(std::memory_order_relaxed);
+        while (old < value &&
+               !peak.compare_exchange_weak(old, value,
+                                           std::memory_order_relaxed)) {}
+    }
+
+    inline static std::array<counter, TAG_NUMBER + 1> counters{};
+    // bit i set if windows[i] is open
+    inline static std::atomic<std::uint64_t> open_windows{};
+    inline static std::array<atomic_bytes, WINDOW_NUMBER> windows{};
+    inline static std::atomic<bool> windowing{};
+};
+
+#endif  // MEMORY_ACCOUNT_H
@@ -0,0 +1,181 @@
+#ifndef PACKED_SYMMETRIC_MATRIX_H
+#define PACKED_SYMMETRIC_MATRIX_H
+
+#include <complex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef EMME_EXPRESSION_TEMPLATE
+#include "Arithmetics.h"
+#endif
+
+/**
+ * @brief Symmetric (not Hermitian) square matrix, only the upper triangle is
+ * stored, packed column by column as LAPACK does with uplo = 'U'. Element
+ * (i, j) with i <= j lives at i + j * (j + 1) / 2, and (j, i) refers to the
+ * same storage.
+ *
+ */
+template <typename T, typename A = std::allocator<T>>
+class PackedSymmetricMatrix
+#ifdef EMME_EXPRESSION_TEMPLATE
+    : public util::ExpressionTemplate
+#endif
+{
+   public:
+    using size_type = std::size_t;
+    using value_type = T;
+    using allocator_type = A;
+    using matrix_type = PackedSymmetricMatrix<value_type, allocator_type>;
+
+    // Constructor with dimensions, only square matrix is allowed
+    PackedSymmetricMatrix(size_type rows, size_type cols)
+        : dim_(rows), data_(rows * (rows + 1) / 2) {
+        if (rows != cols) {
+            throw std::invalid_argument("Symmetric matrix must be square.");
+        }
+    }
+
+    auto begin() const noexcept {
+        return data_.begin();
+    }
+    auto end() const noexcept {
+        return data_.end();
+    }
+
+    // Access element at (row, col)
+    value_type& operator()(size_type row, size_type col) {
+        return data_[index(row, col)];
+    }
+
+    const value_type& operator()(size_type row, size_type col) const {
+        return data_[index(row, col)];
+    }
+
+    matrix_type& operator-=(const matrix_type& other) {
+#ifdef EMME_DEBUG
+        if (dim_ != other.dim_) {
+            throw std::invalid_argument(
+                "Matrices must have the same dimensions for subtraction.");
+        }
+#endif
+        for (size_type i = 0; i < data_.size(); ++i) {
+            data_[i] -= other.data_[i];
+        }
+        return *this;
+    }
+
+    matrix_type& operator/=(const T& scalar) {
+        for (auto& v : data_) { v /= scalar; }
+        return *this;
+    }
+
+#ifdef EMME_EXPRESSION_TEMPLATE
+    template <util::expression_template U>
+    matrix_type& operator=(const U& other) {
+        for (size_type i = 0; i < data_.size(); ++i) { data_[i] = other[i]; }
+        return *this;
+    }
+
+    const value_type& operator[](size_type idx) const {
+        return data_[idx];
+    }
+
+#else
+    friend matrix_type operator-(matrix_type a, const matrix_type& b) {
+        a -= b;
+        return a;
+    }
+    friend matrix_type operator/(matrix_type m, const value_type& a) {
+        m /= a;
+        return m;
+    }
+#endif
+    size_type getRows() const {
+        return dim_;
+    }
+
+    size_type getCols() const {
+        return dim_;
+    }
+
+    // Number of stored elements
+    size_type size() const {
+        return data_.size();
+    }
+
+    std::vector<value_type> getRow(size_type row) const {
+        std::vector<value_type> row_view(dim_);
+        for (size_type j = 0; j < dim_; ++j) { row_view[j] = (*this)(row, j); }
+        return row_view;
+    }
+
+    // by symmetry
+    std::vector<value_type> getCol(size_type col) const {
+        return getRow(col);
+    }
+
+    value_type trace() const {
+        value_type sum{};
+        for (size_type i = 0; i < dim_; ++i) { sum += operator()(i, i); }
+        return sum;
+    }
+
+    /**
+     * @brief trace(a * b) of two symmetric matrices, which is the sum of
+     * element-wise product, so off-diagonal elements count twice.
+     *
+     */
+    friend value_type trace_product(const matrix_type& a, const matrix_type& b) {
+        value_type diag{};
+        value_type off_diag{};
+        for (size_type j = 0; j < a.dim_; ++j) {
+            const auto col = j * (j + 1) / 2;
+            for (size_type i = 0; i < j; ++i) {
+                off_diag += a.data_[col + i] * b.data_[col + i];
+            }
+            diag += a.data_[col + j] * b.data_[col + j];
+        }
+        return diag + value_type{2} * off_diag;
+    }
+
+    // Full storage copy, for routines without packed variant
+    template <typename M>
+    M unpack() const {
+        M m(dim_, dim_);
+        for (size_type j = 0; j < dim_; ++j) {
+            for (size_type i = 0; i <= j; ++i) {
+                m(i, j) = m(j, i) = (*this)(i, j);
+            }
+        }
+        return m;
+    }
+
+    auto data() {
+        return data_.data();
+    }
+
+   private:
+    size_type dim_;
+    std::vector<value_type, allocator_type> data_;
+
+    size_type index(size_type row, size_type col) const {
+#ifdef EMME_DEBUG
+        if (row >= dim_ || col >= dim_) {
+            throw std::out_of_range("Matrix index out of bounds");
+        }
+#endif
+        if (row > col) { std::swap(row, col); }
+        return row + col * (col + 1) / 2;
+    }
+};
+
+template <typename M>
+inline constexpr bool is_packed_symmetric_v = false;
+
+template <typename T, typename A>
+inline constexpr bool is_packed_symmetric_v<PackedSymmetricMatrix<T, A>> =
+    true;
+
+#endif  // PACKED_SYMMETRIC_MATRIX_H
@@ -3,8 +3,12 @@
 
 #include <array>
 #include <complex>
+#include <vector>
 
+#include "Grid.h"
 #include "JsonParser.h"
+#include "aligned-allocator.h"
+#include "functions.h"
 
 // Structure to hold simulation parameters
 struct Parameters {
@@ -41,11 +45,65 @@ struct Parameters {
     double omega_s_e;    // Calculated in constructor
     double omega_d_bar;  // Calculated in constructor
     bool drift_center_transformation_switch;
+    // Keep omega-independent integrand factors of each matrix element
+    // across Newton iterations, optional, default to false
+    bool kernel_cache;
+    // Assemble d(matrix)/d(omega) from closed form in the same quadrature
+    // pass instead of secant differencing, optional, default to false
+    bool analytic_derivative;
+    // Keep eigen matrices in packed upper triangle storage and use packed
+    // LAPACK routines, optional, default to false
+    bool packed_storage;
+    // Factorize in single precision and refine to double precision in
+    // Newton iteration, full storage only, optional, default to false
+    bool mixed_precision;
+
+    // {value, d/d(omega)}
+    using kappa_derivative_type = util::StaticVector<std::complex<double>, 2>;
+    // {m = 0, 1, 2, d/d(omega) of m = 0, 1, 2}
+    using kappa_moments_derivative_type =
+        util::StaticVector<std::complex<double>, 6>;
+
+    /**
+     * @brief Omega-independent factors of the kappa_f_tau integrand at one
+     * quadrature node. The integrand weighted by quadrature weight reads
+     *     norm_vel^m * exp(log_coef + i*taut*omega) * (omega*c1 + c0)
+     * where the weight is already folded into c0 and c1.
+     *
+     */
+    struct KernelSample {
+        std::complex<double> taut;
+        std::complex<double> norm_vel;
+        std::complex<double> log_coef;
+        std::complex<double> c0;
+        std::complex<double> c1;
+
+        std::complex<double> operator()(unsigned int m,
+                                        std::complex<double> omega) const;
+        // m = 0, 1, 2 at once
+        util::StaticVector<std::complex<double>, 3> moments(
+            std::complex<double> omega) const;
+        // Only exp(i*taut*omega) and omega*c1 depend on omega, so the
+        // derivative comes almost for free
+        kappa_derivative_type with_derivative(unsigned int m,
+                                              std::complex<double> omega) const;
+        kappa_moments_derivative_type moments_with_derivative(
+            std::complex<double> omega) const;
+    };
+    // samples of a pair of grid points, cached by EigenSolver
+    using kernel_samples_type =
+        util::tagged_vector<KernelSample, MemoryAccount::kernels>;
+    using kappa_moments_type = util::StaticVector<std::complex<double>, 3>;
+    using node_geometry = Grid<double>::NodeGeometry;
     virtual void parameterInit();
     virtual double g_integration_f(double eta) const;
     double beta_1(double eta, double eta_p) const;
     double beta_1_e(double eta, double eta_p) const;
+    // same as above, reading tabulated g_integration_f
+    double beta_1(const node_geometry&, const node_geometry&) const;
+    double beta_1_e(const node_geometry&, const node_geometry&) const;
     virtual double bi(double eta) const;
+    node_geometry geometry(double eta) const;
 
     std::complex<double> lambda_f_tau(double eta,
                                       double eta_p,
@@ -59,14 +117,98 @@ struct Parameters {
                                      double eta_p,
                                      std::complex<double>) const;
 
+    std::complex<double> kappa_f_tau(unsigned int m,
+                                     const node_geometry&,
+                                     const node_geometry&,
+                                     std::complex<double>) const;
+
+    // Same as above but summing over a fixed rule given by
+    // kappa_f_tau_samples, only valid when sign of Re(omega) does not change
+    std::complex<double> kappa_f_tau(unsigned int m,
+                                     const kernel_samples_type&,
+                                     std::complex<double>) const;
+
+    // kappa_f_tau with m = 0, 1, 2 integrated in one adaptive pass, the
+    // subdivision is shared and refined until all three converge
+    kappa_moments_type kappa_f_tau_moments(const node_geometry&,
+                                           const node_geometry&,
+                                           std::complex<double>) const;
+
+    kappa_moments_type kappa_f_tau_moments(const kernel_samples_type&,
+                                           std::complex<double>) const;
+
+    // kappa_f_tau and its omega derivative integrated in one pass
+    kappa_derivative_type kappa_f_tau_with_derivative(
+        unsigned int m,
+        const node_geometry&,
+        const node_geometry&,
+        std::complex<double>) const;
+
+    kappa_derivative_type kappa_f_tau_with_derivative(
+        unsigned int m,
+        const kernel_samples_type&,
+        std::complex<double>) const;
+
+    kappa_moments_derivative_type kappa_f_tau_moments_with_derivative(
+        const node_geometry&,
+        const node_geometry&,
+        std::complex<double>) const;
+
+    kappa_moments_derivative_type kappa_f_tau_moments_with_derivative(
+        const kernel_samples_type&,
+        std::complex<double>) const;
+
+    kernel_samples_type kappa_f_tau_samples(
+        const node_geometry&,
+        const node_geometry&,
+        std::complex<double> omega) const;
+
     std::complex<double> kappa_f_tau_e(unsigned int m,
                                        double eta,
                                        double eta_p,
                                        std::complex<double>) const;
 
+    std::complex<double> kappa_f_tau_e(unsigned int m,
+                                       const node_geometry&,
+                                       const node_geometry&,
+                                       std::complex<double>) const;
+
+    std::complex<double> kappa_f_tau_e_derivative(unsigned int m,
+                                                  const node_geometry&,
+                                                  const node_geometry&,
+                                                  std::complex<double>) const;
+
    protected:
     // Constructor
     Parameters(const util::json::Value&);
+
+   private:
+    // integrate sample_func(KernelSample) along the tau contour, with
+    // prefactor of kappa_f_tau applied
+    template <typename SampleFunc>
+    auto integrate_kernel(const node_geometry&,
+                          const node_geometry&,
+                          std::complex<double> omega,
+                          SampleFunc&& sample_func) const;
+
+    // same as above but summing over a fixed rule
+    template <typename SampleFunc>
+    auto sum_kernel(const kernel_samples_type&,
+                    SampleFunc&& sample_func) const;
+
+    // omega-independent integrand factors at N nodes at once
+    template <std::size_t N>
+    std::array<KernelSample, N> kernel_sample_batch(
+        const node_geometry& node,
+        const node_geometry& node_p,
+        double omi,
+        const std::array<double, N>& taut_transformed) const;
+
+    KernelSample kernel_sample(const node_geometry& node,
+                               const node_geometry& node_p,
+                               double omi,
+                               double taut_transformed,
+                               double weight = 1.) const;
 };
 
 struct Stellarator : public Parameters {
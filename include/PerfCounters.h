@@ -0,0 +1,55 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Hardware performance counters of the calling thread, by Linux
+ * perf_event_open. Counters of a thread are opened as one group on its first
+ * read, so that they count over the same time, and values are scaled by
+ * enabled / running time in case the kernel multiplexes them.
+ *
+ * Counting is off until enable() succeeds, e.g. it fails when
+ * /proc/sys/kernel/perf_event_paranoid is above 2, in virtual machines
+ * without PMU, or on other systems than Linux. A counter which can not be
+ * opened on its own (fp_vector is a raw event of Intel cores since Skylake)
+ * reads 0 and is marked unavailable.
+ */
+class PerfCounters {
+   public:
+    enum Counter : std::size_t {
+        cycles,
+        instructions,
+        llc_misses,
+        branch_misses,
+        // retired 128/256/512-bit packed floating point instructions
+        fp_vector,
+        COUNTER_NUMBER
+    };
+    using values = std::array<std::uint64_t, COUNTER_NUMBER>;
+
+    /**
+     * @brief Turn counting on for all threads, opening counters of the
+     * calling thread to see whether it works. Print the reason to std::cerr
+     * on failure.
+     *
+     * @return false if counters can not be opened
+     */
+    static bool enable();
+    static bool enabled() {
+        return counting.load(std::memory_order_relaxed);
+    }
+    // Whether the counter opened on the thread which called enable
+    static bool available(Counter counter);
+    static const char* name(Counter counter);
+    // Running totals of the calling thread, zeros when not enabled
+    static values read();
+
+   private:
+    inline static std::atomic<bool> counting{};
+};
+
+#endif  // PERF_COUNTERS_H
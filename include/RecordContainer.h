@@ -0,0 +1,189 @@
+#ifndef RECORD_CONTAINER_H
+#define RECORD_CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AsyncFileWriter.h"
+
+/**
+ * @brief One file holding every eigen matrix (or PIC field) of a run as
+ * records, each with a fixed size header describing its shape, type, scan
+ * point, omega and time step, so that readers need not guess.
+ *
+ * Layout, all integers little endian:
+ *  - file header, 64 bytes, magic "EMMEDUMP"
+ *  - records: a 256 bytes RecordHeader followed by its data, padded so that
+ *    every header and data starts at a multiple of ALIGNMENT from the file
+ *    start. Between records there may be 64 bytes discard marks, magic
+ *    "EMMEDSC", with the index of a record that was discarded after it was
+ *    written
+ *  - index: copies of all record headers, in order, DISCARDED flags set
+ *  - trailer, 64 bytes, magic "EMMEINDX", offset of the index and record
+ *    number
+ *
+ * Mapping the whole file gives aligned arrays of every record without copy.
+ * The index is written on close, a file without trailer (crashed run) can
+ * still be read by walking the record headers and discard marks from the
+ * start.
+ */
+class RecordContainer {
+   public:
+    static constexpr std::size_t ALIGNMENT = 64;
+    static constexpr std::uint32_t VERSION = 2;
+    static constexpr std::size_t MAX_SCAN_VALUE = 8;
+
+    enum class DataType : std::uint32_t { complex128 = 0, complex64 = 1 };
+
+    // full: rows x cols row major; upper: row i from column i on
+    enum class Layout : std::uint32_t { full = 0, upper = 1 };
+
+    enum Flag : std::uint32_t { DISCARDED = 1 };
+
+    struct RecordHeader {
+        char magic[8];
+        DataType data_type;
+        Layout layout;
+        std::uint64_t rows;
+        std::uint64_t cols;
+        // from file start
+        std::uint64_t data_offset;
+        std::uint64_t data_size;
+        // NaN when not an eigen solve
+        double omega[2];
+        // PIC time step, -1 when not a PIC field
+        std::int64_t step;
+        std::uint32_t scan_value_number;
+        std::uint32_t flags;
+        double scan_value[MAX_SCAN_VALUE];
+        // "(None)" when not scanning, truncated to fit
+        char scan_key[112];
+    };
+    static_assert(sizeof(RecordHeader) == 256);
+
+    explicit RecordContainer(std::string file_name);
+    // writes index and trailer
+    ~RecordContainer();
+
+    RecordContainer(const RecordContainer&) = delete;
+    RecordContainer& operator=(const RecordContainer&) = delete;
+
+    /**
+     * @brief Record written piece by piece, so that its data need not be in
+     * one buffer. The container stays locked until finish, other threads
+     * wait to append meanwhile. A record left unfinished, as by an
+     * exception, is filled up with zeros and discarded.
+     */
+    class RecordWriter {
+       public:
+        RecordWriter(RecordWriter&&) = default;
+        RecordWriter& operator=(RecordWriter&&) = delete;
+        ~RecordWriter();
+
+        // Next bytes of data, data_size of header in all
+        void write(const void* data, std::size_t bytes);
+
+        // Unlock the container, every byte must have been written
+        //
+        // @return index of the record
+        std::size_t finish();
+
+       private:
+        friend class RecordContainer;
+
+        RecordContainer* container;
+        std::unique_lock<std::mutex> lock;
+        std::size_t idx;
+        std::uint64_t remaining;
+
+        RecordWriter(RecordContainer& container_,
+                     std::unique_lock<std::mutex> lock_,
+                     std::size_t idx_,
+                     std::uint64_t remaining_);
+    };
+
+    /**
+     * @brief Start a record of header.data_size bytes, thread safe. Offsets
+     * and magic of header are filled in here. Nothing else may be done with
+     * the container on this thread until the record is finished.
+     */
+    RecordWriter begin_record(RecordHeader header);
+
+    /**
+     * @brief Append a record in one piece, thread safe.
+     *
+     * @return index of the record
+     */
+    std::size_t append(RecordHeader header, const void* data);
+
+    // Keep record in file but mark it as not to be read, by a discard mark
+    // right away and in index on close
+    void discard(std::size_t index);
+
+    // Wait until every record appended is in file
+    void flush();
+
+    // False if file can not be opened or some write failed, see flush
+    explicit operator bool() const {
+        return static_cast<bool>(file);
+    }
+
+    const std::string& file_name() const {
+        return file.file_name();
+    }
+
+    static std::size_t value_size(DataType data_type) {
+        return data_type == DataType::complex64 ? 8 : 16;
+    }
+
+   private:
+    AsyncFileWriter file;
+    std::mutex mutex;
+    std::uint64_t size{};
+    std::vector<RecordHeader> index;
+
+    void pad();
+    void mark_discarded(std::size_t idx);
+};
+
+/**
+ * @brief Read only memory map of a RecordContainer file.
+ *
+ */
+class RecordContainerView {
+   public:
+    using RecordHeader = RecordContainer::RecordHeader;
+
+    explicit RecordContainerView(const std::string& file_name);
+    ~RecordContainerView();
+
+    RecordContainerView(const RecordContainerView&) = delete;
+    RecordContainerView& operator=(const RecordContainerView&) = delete;
+
+    // Headers of all records, discarded ones included
+    const std::vector<RecordHeader>& records() const {
+        return headers;
+    }
+
+    // Index was not found and records were recovered by walking the file
+    bool recovered() const {
+        return recovered_;
+    }
+
+    // Pointer into the mapping, T must match data type of the record
+    template <typename T>
+    const T* data(std::size_t idx) const {
+        return reinterpret_cast<const T*>(base + headers.at(idx).data_offset);
+    }
+
+   private:
+    const char* base{};
+    std::size_t length{};
+    std::vector<RecordHeader> headers;
+    bool recovered_{};
+};
+
+#endif  // RECORD_CONTAINER_H
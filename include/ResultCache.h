@@ -0,0 +1,53 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <complex>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "JsonParser.h"
+
+/**
+ * @brief On disk cache of eigen solver results, so that reruns and
+ * overlapping scans skip solves already done.
+ *
+ * A solve is identified by the canonical text of its input (object keys
+ * sorted, numbers in full precision, keys that do not change the result
+ * left out), the initial guess it actually starts from and the build hash.
+ * Each result is a file named by hash of that text, the text itself is
+ * stored in the file as well and checked on load.
+ */
+class ResultCache {
+   public:
+    struct Entry {
+        std::complex<double> eigen_value;
+        int iteration_number;
+        bool converged;
+        std::vector<std::complex<double>> eigen_vector;
+    };
+
+    ResultCache(std::filesystem::path directory, std::string build_hash);
+
+    std::string key(const util::json::Value& input,
+                    std::complex<double> initial_guess) const;
+
+    // nothing if not cached, or cache file is unreadable
+    std::optional<Entry> load(const std::string& key) const;
+
+    // written to a temporary file first, so concurrent writers and
+    // interrupted runs never leave a partial entry
+    void store(const std::string& key, const Entry& entry) const;
+
+   private:
+    std::filesystem::path directory;
+    std::string build_hash;
+
+    std::filesystem::path file_path(const std::string& key) const;
+
+    static void canonical(std::ostream&, const util::json::Value&, bool);
+};
+
+#endif  // RESULT_CACHE_H
@@ -0,0 +1,66 @@
+#ifndef RESULT_STREAM_H
+#define RESULT_STREAM_H
+
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "JsonParser.h"
+
+/**
+ * @brief Appends results of scan points to a file as soon as they are
+ * solved, one JSON object per line (NDJSON), so that progress can be
+ * followed with tail and a crashed run loses nothing but the points being
+ * solved.
+ *
+ * The first line holds the format version and the input. When the file exists
+ * with this version and its input only differs in scan ranges, its points
+ * are taken as completed and new points are appended to it, so an
+ * interrupted or extended scan resumes. A file of another version or input
+ * is renamed to the first free "<file_name>.<n>" instead.
+ * Numbers are written with full precision, so that resumed points are
+ * found by their exact scan values.
+ */
+class ResultStream {
+   public:
+    // 2: eigen results have "converged"
+    static constexpr int VERSION = 2;
+
+    // fsync after every sync_interval points, 0 leaves it to the system
+    ResultStream(const std::string& file_name,
+                 const util::json::Value& input,
+                 std::size_t sync_interval);
+    ~ResultStream();
+
+    ResultStream(const ResultStream&) = delete;
+    ResultStream& operator=(const ResultStream&) = delete;
+
+    // result of a point in the file already
+    std::optional<util::json::Value> completed(
+        const std::string& scan_key,
+        const util::json::Value& scan_value) const;
+
+    // thread safe
+    void append(const std::string& scan_key,
+                const util::json::Value& scan_value,
+                const util::json::Value& result);
+
+    std::size_t completed_number() const {
+        return completed_points.size();
+    }
+
+   private:
+    int fd;
+    std::size_t sync_interval;
+    std::size_t unsynced{};
+    std::mutex write_mutex;
+    std::unordered_map<std::string, util::json::Value> completed_points;
+
+    static std::string point_id(const std::string& scan_key,
+                                const util::json::Value& scan_value);
+    void write_line(const std::string& line);
+};
+
+#endif  // RESULT_STREAM_H
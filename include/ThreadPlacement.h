@@ -0,0 +1,57 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <atomic>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Pinning of the workers of DedicatedThreadPool to CPUs, so that a
+ * worker stays on one NUMA node and keeps finding its data in local memory.
+ *
+ * A placement policy orders the CPUs the process may run on:
+ *   compact  NUMA node after node, and on a node one hardware thread of every
+ *            core before their SMT siblings
+ *   scatter  round-robin over NUMA nodes, each node in compact order
+ * The pool is made with one worker per CPU of the list, worker i pinned to
+ * the i-th, so placement has to be set up before anything uses the pool. The
+ * calling thread is not pinned.
+ *
+ * Once workers are pinned, long-lived memory mapped on its own by HugePages
+ * (eigen matrices and PIC markers) is first touched by all workers, each
+ * writing its worker_block of the pages, and PIC_State processes markers in
+ * the same blocks. Topology is read from /sys/devices/system, a system
+ * without it is taken as one node.
+ */
+class ThreadPlacement {
+   public:
+    enum class Policy { compact, scatter };
+
+    // throw std::invalid_argument for an unknown name
+    static Policy parse_policy(std::string_view name);
+    static const char* name(Policy);
+
+    // CPUs allowed for the process, in the order of policy
+    static std::vector<unsigned> cpus(Policy policy);
+    // NUMA node of a CPU, 0 if unknown
+    static unsigned node_of(unsigned cpu);
+
+    /**
+     * @brief Make the pool with cpus.size() workers, pin worker i to cpus[i]
+     * and set the first touch function of HugePages. Print the placement to
+     * std::cout, or the reason to std::cerr on failure, in which case
+     * workers are left unpinned.
+     *
+     * @return false if cpus is empty, the pool was made before with more
+     * workers than cpus, or some worker can not be pinned
+     */
+    static bool pin_workers(const std::vector<unsigned>& cpus);
+    static bool pinned() {
+        return pinning.load(std::memory_order_relaxed);
+    }
+
+   private:
+    inline static std::atomic<bool> pinning{};
+};
+
+#endif  // THREAD_PLACEMENT_H
@@ -2,36 +2,168 @@
 #define TIMER_H
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include <unordered_map>
-#include <utility>
+#include <string_view>
 #include <vector>
 
+#include "MemoryAccount.h"
+#include "PerfCounters.h"
+
+/**
+ * @brief Hierarchical profiler, one per thread. Timed zones nest into a call
+ * tree of the thread, which adds up time and count of every path, and are
+ * optionally recorded as events of a Chrome/Perfetto trace.
+ *
+ * Zone names are interned into ids once, so that timing a zone takes two
+ * clock reads and no lock or allocation in steady state. Hot paths should
+ * use Zone with the id kept in a static local:
+ *
+ *     static const auto zone_id = Timer::intern("Field Solve");
+ *     Timer::Zone zone(zone_id);
+ *
+ * With PerfCounters enabled, every zone also adds up the hardware counters
+ * of its thread, read at open and close. With MemoryAccount enabled, every
+ * zone keeps the peak bytes held by tagged allocators while it is open,
+ * allocations of all threads included.
+ *
+ * A thread only ever writes its own timer. Reading timers of other threads
+ * (print_threads, write_trace) is meant for when they are idle, e.g. at the
+ * end of a run.
+ */
 class Timer {
    public:
+    using clock = std::chrono::steady_clock;
+    using zone_id = std::uint32_t;
+
+    struct zone_summary {
+        std::string name;
+        // summed over threads
+        double seconds;
+        std::uint64_t count;
+        PerfCounters::values counters;
+        // highest over threads and calls
+        MemoryAccount::bytes memory;
+    };
+
+    /**
+     * @brief Time a scope as zone on the timer of current thread. Zones
+     * opened by start_timing inside the scope and left open are closed too.
+     */
+    class Zone {
+       public:
+        explicit Zone(zone_id id)
+            : timer(get_timer()), depth(timer.open(id)) {}
+        ~Zone() {
+            timer.close(depth);
+        }
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+       private:
+        Timer& timer;
+        std::size_t depth;
+    };
+
+    // Id of a zone name, thread safe
+    static zone_id intern(std::string_view name);
+
+    // Timer of current thread
     static Timer& get_timer();
-    void start_timing(std::string func_name);
-    void pause_and_start(std::string func_name);
+    // Open a zone nested in the open ones, restarting it if already open
+    void start_timing(std::string_view func_name);
+    void pause_and_start(std::string_view func_name);
+    // Close the innermost open zone
     void pause_timing();
-    void pause_timing(std::string func_name);
+    // Close the innermost open zone of this name, and zones opened in it
+    void pause_timing(std::string_view func_name);
+    // Forget the call tree, trace events are kept
     void reset();
+    // Add up the call tree of another thread's timer, called from that
+    // thread. It goes to an accumulator of its own under a lock, never to
+    // the zones this timer's thread keeps timing, so both may run at once.
+    void merge(const Timer&);
+    // Zones in the order first opened, then the call tree
     void print();
 
+    // Per-thread time of zones timed on more than one thread
+    static void print_threads();
+    // Zones closed so far on all threads, merged ones included, in the order
+    // first opened
+    static std::vector<zone_summary> summary();
+    // Hardware counters of summary(), if PerfCounters is enabled
+    static void print_counters();
+    // Peak memory of summary(), if MemoryAccount is enabled
+    static void print_memory();
+    // Record trace events from now on
+    static void enable_trace();
+    /**
+     * @brief Write events of all threads in Chrome trace event format, to be
+     * opened in chrome://tracing or ui.perfetto.dev
+     *
+     * @return false if the file can not be written
+     */
+    static bool write_trace(const std::string& file_name);
+
    private:
-    Timer() = default;
+    struct node {
+        zone_id zone;
+        std::uint32_t parent;
+        std::uint32_t first_child;
+        std::uint32_t next_sibling;
+        clock::duration total;
+        std::uint64_t count;
+        PerfCounters::values counters;
+        MemoryAccount::bytes memory;
+    };
+
+    struct open_zone {
+        std::uint32_t node;
+        clock::time_point start;
+        PerfCounters::values counters;
+        MemoryAccount::window_id window;
+    };
+
+    struct event {
+        zone_id zone;
+        clock::time_point start;
+        clock::time_point end;
+    };
+
+    explicit Timer(std::size_t thread_idx);
     Timer(const Timer&) = delete;
     Timer(Timer&&) = delete;
     decltype(auto) operator=(const Timer&) = delete;
     decltype(auto) operator=(Timer&&) = delete;
 
-    std::vector<std::string> entries;
-    std::unordered_map<
-        std::string,
-        std::pair<std::chrono::high_resolution_clock::duration,
-                  std::chrono::high_resolution_clock::time_point>>
-        time_consuming;
+    // return depth of the new zone
+    std::size_t open(zone_id id);
+    // close zones from depth on
+    void close(std::size_t depth);
+    // nodes of this thread with merged ones added
+    std::vector<node> call_tree() const;
+
+    static std::vector<node> root_tree();
+    // sum of every zone in tree indexed by zone id, not counting zones
+    // nested in the same zone twice, and zones in the order first opened
+    static std::vector<node> zone_totals(
+        const std::vector<node>& tree,
+        std::size_t zone_number,
+        std::vector<zone_id>& order);
+    // child of parent for zone, appended if not there
+    static std::uint32_t child(std::vector<node>& tree,
+                               std::uint32_t parent,
+                               zone_id id);
+    static void add_tree(std::vector<node>& to, const std::vector<node>& from);
 
-    std::string current_func_name;
+    std::size_t thread_idx;
+    // nodes[0] is the root
+    std::vector<node> nodes;
+    std::vector<open_zone> stack;
+    std::vector<event> events;
+    // from merge, guarded by a lock since other threads write it
+    std::vector<node> merged;
 };
 
 #endif
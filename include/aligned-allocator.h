@@ -14,6 +14,10 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <vector>
+
+#include "HugePages.h"
+#include "MemoryAccount.h"
 
 namespace util {
 
@@ -23,11 +27,23 @@ enum class Alignment : std::size_t {
     QUAD = 32,
     OCTU = 64,
     SEDE = 128,
+    // 2 MiB for large blocks, to be backed by huge pages, see HugePages
+    HUGE_PAGE = HugePages::PAGE_BYTES,
 };
 
 namespace detail {
+// Only long-lived blocks which all workers go through are first touched by
+// them, see HugePages, not short-lived work arrays
+constexpr bool first_touched(MemoryAccount::Tag tag) {
+    return tag == MemoryAccount::matrix || tag == MemoryAccount::pic_markers;
+}
+
 static inline void* allocate_aligned_memory(std::size_t align,
-                                            std::size_t size) {
+                                            std::size_t size,
+                                            bool first_touch) {
+    if (align == static_cast<std::size_t>(Alignment::HUGE_PAGE)) {
+        return HugePages::allocate(size, first_touch);
+    }
     void* ptr;
 #ifdef _MSC_VER
     ptr = _aligned_malloc(size, align);
@@ -36,7 +52,12 @@ static inline void* allocate_aligned_memory(std::size_t align,
 #endif
     return ptr;
 }
-static inline void deallocate_aligned_memory(void* ptr) noexcept {
+static inline void deallocate_aligned_memory(void* ptr,
+                                             std::size_t align,
+                                             std::size_t size) noexcept {
+    if (align == static_cast<std::size_t>(Alignment::HUGE_PAGE)) {
+        return HugePages::deallocate(ptr, size);
+    }
 #ifdef _MSC_VER
     _aligned_free(ptr);
 #else
@@ -45,11 +66,14 @@ static inline void deallocate_aligned_memory(void* ptr) noexcept {
 }
 }  // namespace detail
 
-template <typename T, Alignment Align = Alignment::OCTU>
+// Bytes allocated are added to the tag in MemoryAccount
+template <typename T,
+          Alignment Align = Alignment::OCTU,
+          MemoryAccount::Tag Tag = MemoryAccount::other>
 class AlignedAllocator;
 
-template <Alignment Align>
-class AlignedAllocator<void, Align> {
+template <Alignment Align, MemoryAccount::Tag Tag>
+class AlignedAllocator<void, Align, Tag> {
    public:
     using pointer = void*;
     using const_pointer = const void*;
@@ -57,11 +81,11 @@ class AlignedAllocator<void, Align> {
 
     template <class U>
     struct rebind {
-        typedef AlignedAllocator<U, Align> other;
+        typedef AlignedAllocator<U, Align, Tag> other;
     };
 };
 
-template <typename T, Alignment Align>
+template <typename T, Alignment Align, MemoryAccount::Tag Tag>
 class AlignedAllocator {
    public:
     using value_type = T;
@@ -76,14 +100,14 @@ class AlignedAllocator {
 
     template <class U>
     struct rebind {
-        typedef AlignedAllocator<U, Align> other;
+        typedef AlignedAllocator<U, Align, Tag> other;
     };
 
    public:
     AlignedAllocator() noexcept {}
 
     template <class U>
-    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+    AlignedAllocator(const AlignedAllocator<U, Align, Tag>&) noexcept {}
 
     size_type max_size() const noexcept {
         return (size_type(~0) - size_type(Align)) / sizeof(T);
@@ -97,16 +121,20 @@ class AlignedAllocator {
 
     pointer allocate(
         size_type n,
-        typename AlignedAllocator<void, Align>::const_pointer = nullptr) {
+        typename AlignedAllocator<void, Align, Tag>::const_pointer = nullptr) {
         const size_type alignment = static_cast<size_type>(Align);
-        void* ptr = detail::allocate_aligned_memory(alignment, n * sizeof(T));
+        void* ptr = detail::allocate_aligned_memory(
+            alignment, n * sizeof(T), detail::first_touched(Tag));
         if (ptr == nullptr) { throw std::bad_alloc(); }
+        MemoryAccount::allocated(Tag, n * sizeof(T));
 
         return reinterpret_cast<pointer>(ptr);
     }
 
-    void deallocate(pointer p, size_type) noexcept {
-        return detail::deallocate_aligned_memory(p);
+    void deallocate(pointer p, size_type n) noexcept {
+        MemoryAccount::deallocated(Tag, n * sizeof(T));
+        return detail::deallocate_aligned_memory(
+            p, static_cast<size_type>(Align), n * sizeof(T));
     }
 
     template <class U, class... Args>
@@ -117,8 +145,8 @@ class AlignedAllocator {
     void destroy(pointer p) { p->~T(); }
 };
 
-template <typename T, Alignment Align>
-class AlignedAllocator<const T, Align> {
+template <typename T, Alignment Align, MemoryAccount::Tag Tag>
+class AlignedAllocator<const T, Align, Tag> {
    public:
     using value_type = T;
     using pointer = const T*;
@@ -132,14 +160,14 @@ class AlignedAllocator<const T, Align> {
 
     template <class U>
     struct rebind {
-        typedef AlignedAllocator<U, Align> other;
+        typedef AlignedAllocator<U, Align, Tag> other;
     };
 
    public:
     AlignedAllocator() noexcept {}
 
     template <class U>
-    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+    AlignedAllocator(const AlignedAllocator<U, Align, Tag>&) noexcept {}
 
     size_type max_size() const noexcept {
         return (size_type(~0) - size_type(Align)) / sizeof(T);
@@ -151,16 +179,20 @@ class AlignedAllocator<const T, Align> {
 
     pointer allocate(
         size_type n,
-        typename AlignedAllocator<void, Align>::const_pointer = 0) {
+        typename AlignedAllocator<void, Align, Tag>::const_pointer = 0) {
         const size_type alignment = static_cast<size_type>(Align);
-        void* ptr = detail::allocate_aligned_memory(alignment, n * sizeof(T));
+        void* ptr = detail::allocate_aligned_memory(
+            alignment, n * sizeof(T), detail::first_touched(Tag));
         if (ptr == nullptr) { throw std::bad_alloc(); }
+        MemoryAccount::allocated(Tag, n * sizeof(T));
 
         return reinterpret_cast<pointer>(ptr);
     }
 
-    void deallocate(pointer p, size_type) noexcept {
-        return detail::deallocate_aligned_memory(p);
+    void deallocate(pointer p, size_type n) noexcept {
+        MemoryAccount::deallocated(Tag, n * sizeof(T));
+        return detail::deallocate_aligned_memory(
+            p, static_cast<size_type>(Align), n * sizeof(T));
     }
 
     template <class U, class... Args>
@@ -171,18 +203,38 @@ class AlignedAllocator<const T, Align> {
     void destroy(pointer p) { p->~T(); }
 };
 
-template <typename T, Alignment TAlign, typename U, Alignment UAlign>
-inline bool operator==(const AlignedAllocator<T, TAlign>&,
-                       const AlignedAllocator<U, UAlign>&) noexcept {
-    return TAlign == UAlign;
+template <typename T,
+          Alignment TAlign,
+          MemoryAccount::Tag TTag,
+          typename U,
+          Alignment UAlign,
+          MemoryAccount::Tag UTag>
+inline bool operator==(const AlignedAllocator<T, TAlign, TTag>&,
+                       const AlignedAllocator<U, UAlign, UTag>&) noexcept {
+    return TAlign == UAlign && TTag == UTag;
 }
 
-template <typename T, Alignment TAlign, typename U, Alignment UAlign>
-inline bool operator!=(const AlignedAllocator<T, TAlign>&,
-                       const AlignedAllocator<U, UAlign>&) noexcept {
-    return TAlign != UAlign;
+template <typename T,
+          Alignment TAlign,
+          MemoryAccount::Tag TTag,
+          typename U,
+          Alignment UAlign,
+          MemoryAccount::Tag UTag>
+inline bool operator!=(const AlignedAllocator<T, TAlign, TTag>&,
+                       const AlignedAllocator<U, UAlign, UTag>&) noexcept {
+    return !(TAlign == UAlign && TTag == UTag);
 }
 
+// std::vector with its bytes counted under Tag
+template <typename T, MemoryAccount::Tag Tag>
+using tagged_vector =
+    std::vector<T, AlignedAllocator<T, Alignment::OCTU, Tag>>;
+
+// same as above, large ones backed by huge pages
+template <typename T, MemoryAccount::Tag Tag>
+using huge_page_vector =
+    std::vector<T, AlignedAllocator<T, Alignment::HUGE_PAGE, Tag>>;
+
 }  // namespace util
 
 #endif  // ALIGN_ALLOC_H
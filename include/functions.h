@@ -56,6 +56,63 @@ using get_float_t = typename lazy_conditional<std::is_scalar_v<T>,
                                               get_value_type,
                                               T>::type;
 
+/**
+ * @brief Fixed size vector with element-wise arithmetic. Used as the return
+ * type of vector-valued integrands, so that several integrals share one
+ * adaptive subdivision. Its abs is the max norm, which makes the combined
+ * error estimate the largest error among components.
+ *
+ */
+template <typename T, std::size_t N>
+struct StaticVector {
+    using value_type = get_float_t<T>;
+    std::array<T, N> elements;
+
+    decltype(auto) operator[](std::size_t idx) const { return elements[idx]; }
+    decltype(auto) operator[](std::size_t idx) { return elements[idx]; }
+
+    StaticVector& operator+=(const StaticVector& other) {
+        for (std::size_t i = 0; i < N; ++i) { elements[i] += other[i]; }
+        return *this;
+    }
+    StaticVector& operator-=(const StaticVector& other) {
+        for (std::size_t i = 0; i < N; ++i) { elements[i] -= other[i]; }
+        return *this;
+    }
+    StaticVector& operator*=(const value_type& a) {
+        for (auto& e : elements) { e *= a; }
+        return *this;
+    }
+
+    friend StaticVector operator+(StaticVector lhs, const StaticVector& rhs) {
+        return lhs += rhs;
+    }
+    friend StaticVector operator-(StaticVector lhs, const StaticVector& rhs) {
+        return lhs -= rhs;
+    }
+    friend StaticVector operator*(const value_type& a, StaticVector v) {
+        return v *= a;
+    }
+    friend StaticVector operator*(StaticVector v, const value_type& a) {
+        return v *= a;
+    }
+    friend StaticVector operator/(StaticVector v, const value_type& a) {
+        return v *= (1 / a);
+    }
+    friend StaticVector operator*(const T& a, StaticVector v) requires(
+        !std::is_same_v<T, value_type>) {
+        for (auto& e : v.elements) { e *= a; }
+        return v;
+    }
+    friend value_type abs(const StaticVector& v) {
+        value_type m{};
+        for (const auto& e : v.elements) {
+            m = std::max<value_type>(m, std::abs(e));
+        }
+        return m;
+    }
+};
+
 // auxiliary function for Gauss-Kronrod quadrature
 namespace detail {
 
@@ -161,6 +218,14 @@ struct gauss_kronrod_detail<31> {
     }
 };
 
+/**
+ * @brief A batched integrand receives all N abscissas of a panel at once and
+ * returns the N values, which allows it to vectorize across nodes.
+ *
+ */
+template <typename Func, typename Tx, size_t N>
+concept batch_integrand = std::invocable<const Func&, const std::array<Tx, N>&>;
+
 /**
  * @brief Order N Gauss-Kronrod quadrature, with embedded Gauss quadrature order
  * = (N-1)/2
@@ -170,6 +235,38 @@ template <size_t N, typename Tx>
 struct gauss_kronrod : gauss_kronrod_detail<N> {
     using base = gauss_kronrod_detail<N>;
 
+    /**
+     * @brief All N abscissas on [-1, 1], ordered as 0, x1, -x1, x2, -x2, ...
+     *
+     */
+    constexpr static std::array<Tx, N> nodes() {
+        std::array<Tx, N> xs{};
+        for (size_t i = 1; i < base::abscissa().size(); ++i) {
+            xs[2 * i - 1] = base::abscissa()[i];
+            xs[2 * i] = -base::abscissa()[i];
+        }
+        return xs;
+    }
+
+    /**
+     * @brief Evaluate the integrand on the nodes mapped to [mid - scale, mid +
+     * scale], in the order of `nodes()`. A batched integrand is called once
+     * with all nodes, other integrands once per node.
+     *
+     */
+    template <typename Func>
+    static auto evaluate(const Func& func, Tx mid, Tx scale) {
+        std::array<Tx, N> xs;
+        for (size_t k = 0; k < N; ++k) { xs[k] = scale * nodes()[k] + mid; }
+        if constexpr (batch_integrand<Func, Tx, N>) {
+            return func(xs);
+        } else {
+            std::array<decltype(func(Tx{})), N> ys;
+            for (size_t k = 0; k < N; ++k) { ys[k] = func(xs[k]); }
+            return ys;
+        }
+    }
+
     /**
      * @brief Core function of gauss-kronrod integrate method, it integrates the
      * given function on [-1, 1].
@@ -179,20 +276,29 @@ struct gauss_kronrod : gauss_kronrod_detail<N> {
      * @return a pair of integral and err
      */
     template <typename Func>
-    auto static gauss_kronrod_basic(const Func& func)
-        -> std::pair<decltype(std::declval<Func>()(std::declval<Tx>())), Tx> {
-        auto f0 = func(Tx{});
-        using Ty = decltype(f0);
+    auto static gauss_kronrod_basic(const Func& func) {
+        return gauss_kronrod_sum(evaluate(func, Tx{}, Tx{1}));
+    }
+
+    /**
+     * @brief Weighted sums of integrand values given in the order of
+     * `nodes()`.
+     *
+     * @return a pair of integral and err
+     */
+    template <typename Ty>
+    auto static gauss_kronrod_sum(const std::array<Ty, N>& ys) {
         using Tc = get_float_t<Ty>;
         constexpr auto gauss_order = (N - 1) / 2;
 
-        Ty gauss_integral = gauss_order & 1
-                                ? static_cast<Tc>(base::gauss_weight()[0]) * f0
-                                : Ty{};
-        Ty kronrod_integral = static_cast<Tc>(base::kronrod_weight()[0]) * f0;
+        Ty gauss_integral =
+            gauss_order & 1 ? static_cast<Tc>(base::gauss_weight()[0]) * ys[0]
+                            : Ty{};
+        Ty kronrod_integral =
+            static_cast<Tc>(base::kronrod_weight()[0]) * ys[0];
 
         for (size_t i = 1; i < base::abscissa().size(); ++i) {
-            Ty f = func(base::abscissa()[i]) + func(-base::abscissa()[i]);
+            Ty f = ys[2 * i - 1] + ys[2 * i];
             gauss_integral +=
                 (gauss_order - i) & 1
                     ? static_cast<Tc>(base::gauss_weight()[i / 2]) * f
@@ -200,27 +306,50 @@ struct gauss_kronrod : gauss_kronrod_detail<N> {
             kronrod_integral += static_cast<Tc>(base::kronrod_weight()[i]) * f;
         }
 
+        using std::abs;  // find util::abs for vector-valued integrand
         return std::make_pair(
             kronrod_integral,
-            std::max(
-                static_cast<Tx>(std::abs(kronrod_integral - gauss_integral)),
-                static_cast<Tx>(std::abs(kronrod_integral) *
-                                std::numeric_limits<Tx>::epsilon() * 2)));
+            std::max(static_cast<Tx>(abs(kronrod_integral - gauss_integral)),
+                     static_cast<Tx>(abs(kronrod_integral) *
+                                     std::numeric_limits<Tx>::epsilon() * 2)));
     }
 
+    /**
+     * @brief Append the abscissas and weights of this rule on [l, r] to
+     * `rule`, each entry is {abscissa, weight}
+     *
+     */
+    static void append_nodes(Tx l, Tx r, std::vector<std::array<Tx, 2>>& rule) {
+        const Tx mid = (r + l) / 2;
+        const Tx scale = (r - l) / 2;
+        for (size_t k = 0; k < N; ++k) {
+            rule.push_back(
+                {scale * nodes()[k] + mid,
+                 static_cast<Tx>(base::kronrod_weight()[(k + 1) / 2]) * scale});
+        }
+    }
+
+    /**
+     * @brief Adaptive integration on [a, b]. If `accepted_panels` is given,
+     * the subintervals finally used are recorded in it.
+     *
+     */
     template <typename Func>
-    auto static gauss_kronrod_adaptive(const Func& func,
-                                       Tx a,
-                                       Tx b,
-                                       size_t max_subdivide,
-                                       Tx abs_tol,
-                                       Tx global_rel_tol,
-                                       Tx precision_goal) {
+    auto static gauss_kronrod_adaptive(
+        const Func& func,
+        Tx a,
+        Tx b,
+        size_t max_subdivide,
+        Tx abs_tol,
+        Tx global_rel_tol,
+        Tx precision_goal,
+        std::vector<std::array<Tx, 2>>* accepted_panels = nullptr) {
         // call stack
         std::vector<std::array<Tx, 2>> pending_intervals;
         // quadrature sum
-        decltype(std::declval<Func>()(std::declval<Tx>())) sum{};
+        std::remove_cvref_t<decltype(evaluate(func, a, b)[0])> sum{};
 
+        using std::abs;  // find util::abs for vector-valued integrand
         Tx inv_scale = 2. / (b - a);
         pending_intervals.push_back({a, b});
         while (!pending_intervals.empty()) {
@@ -229,21 +358,21 @@ struct gauss_kronrod : gauss_kronrod_detail<N> {
 
             const Tx mid = (r + l) / 2;
             const Tx scale = (r - l) / 2;
-            auto normalize_func = [&](Tx x) { return func(scale * x + mid); };
-            auto result = gauss_kronrod_basic(normalize_func);
+            auto result = gauss_kronrod_sum(evaluate(func, mid, scale));
             auto integral = result.first * scale;
             auto err = result.second * scale;
 
             if (std::fpclassify(abs_tol) == FP_ZERO) {
-                abs_tol = std::abs(global_rel_tol * integral);
+                abs_tol = abs(global_rel_tol * integral);
             }
             if (std::ldexp(scale, max_subdivide) > 0.99 * (b - a) &&
                 err > abs_tol * inv_scale + precision_goal &&
-                err > std::abs(global_rel_tol * integral) + precision_goal) {
+                err > abs(global_rel_tol * integral) + precision_goal) {
                 pending_intervals.push_back({mid, r});
                 pending_intervals.push_back({l, mid});
             } else {
                 sum += integral;
+                if (accepted_panels) { accepted_panels->push_back({l, r}); }
             }
         }
 
@@ -251,6 +380,31 @@ struct gauss_kronrod : gauss_kronrod_detail<N> {
     }
 };
 
+/**
+ * @brief Substitute x = tan(t) in the integrand, keeping it batched if it is.
+ *
+ */
+template <size_t N, typename Tx, typename Func>
+auto tan_transformed(const Func& func) {
+    if constexpr (batch_integrand<Func, Tx, N>) {
+        return [&func](const std::array<Tx, N>& ts) {
+            std::array<Tx, N> xs;
+            for (size_t k = 0; k < N; ++k) { xs[k] = std::tan(ts[k]); }
+            auto ys = func(xs);
+            for (size_t k = 0; k < N; ++k) {
+                const Tx c = std::cos(ts[k]);
+                ys[k] = ys[k] / (c * c);
+            }
+            return ys;
+        };
+    } else {
+        return [&func](Tx x) {
+            const Tx c = std::cos(x);
+            return func(std::tan(x)) / (c * c);
+        };
+    }
+}
+
 }  // namespace detail
 
 template <typename Func, typename Ta, typename Tb, typename Te>
@@ -269,10 +423,7 @@ auto integrate(const Func& func,
             std::fpclassify(b) == FP_INFINITE) {
             // either of the endpoints is infinity
             return impl::gauss_kronrod_adaptive(
-                [&](n_type x) {
-                    const n_type c = std::cos(x);
-                    return func(std::tan(x)) / (c * c);
-                },
+                detail::tan_transformed<15, n_type>(func),
                 std::atan(static_cast<n_type>(a)),
                 std::atan(static_cast<n_type>(b)), max_subdivide, n_type{}, tol,
                 prec);
@@ -286,10 +437,7 @@ auto integrate(const Func& func,
             std::fpclassify(b) == FP_INFINITE) {
             // either of the endpoints is infinity
             return impl::gauss_kronrod_adaptive(
-                [&](n_type x) {
-                    const n_type c = std::cos(x);
-                    return func(std::tan(x)) / (c * c);
-                },
+                detail::tan_transformed<31, n_type>(func),
                 std::atan(static_cast<n_type>(a)),
                 std::atan(static_cast<n_type>(b)), max_subdivide, n_type{}, tol,
                 prec);
@@ -299,7 +447,6 @@ auto integrate(const Func& func,
         }
     }
     throw std::runtime_error("integration_start_points should be 15 or 31");
-    return std::complex{0.0, 0.0};  // we will never reach here
 }
 
 template <typename Func, typename Te>
@@ -312,22 +459,58 @@ auto integrate(const Func& func,
     if (integration_start_points == 15) {
         using impl = detail::gauss_kronrod<15, n_type>;
         return impl::gauss_kronrod_adaptive(
-            [&](n_type x) {
-                const n_type c = std::cos(x);
-                return func(std::tan(x)) / (c * c);
-            },
-            0, std::numbers::pi / 2.0, max_subdivide, n_type{}, tol, prec);
+            detail::tan_transformed<15, n_type>(func), 0,
+            std::numbers::pi / 2.0, max_subdivide, n_type{}, tol, prec);
     } else if (integration_start_points == 31) {
         using impl = detail::gauss_kronrod<31, n_type>;
         return impl::gauss_kronrod_adaptive(
-            [&](n_type x) {
-                const n_type c = std::cos(x);
-                return func(std::tan(x)) / (c * c);
-            },
-            0, std::numbers::pi / 2.0, max_subdivide, n_type{}, tol, prec);
+            detail::tan_transformed<31, n_type>(func), 0,
+            std::numbers::pi / 2.0, max_subdivide, n_type{}, tol, prec);
     }
     throw std::runtime_error("integration_start_points should be 15 or 31");
-    return std::complex{0.0, 0.0};  // we will never reach here
+}
+
+/**
+ * @brief Build a fixed quadrature rule on [0, inf) from the subdivision that
+ * the adaptive `integrate` would use for `func`. Integrands that differ only
+ * slightly from `func` can then be integrated by a plain weighted sum.
+ *
+ * @return A vector of {abscissa, weight}
+ */
+template <typename Func, typename Te>
+auto integration_rule(const Func& func,
+                      Te tol,
+                      Te prec,
+                      std::size_t max_subdivide,
+                      std::size_t integration_start_points) {
+    using n_type = Te;
+    std::vector<std::array<n_type, 2>> panels;
+    std::vector<std::array<n_type, 2>> rule;
+    auto build = [&]<std::size_t N>() {
+        using impl = detail::gauss_kronrod<N, n_type>;
+        impl::gauss_kronrod_adaptive(detail::tan_transformed<N, n_type>(func),
+                                     n_type{}, std::numbers::pi / 2.0,
+                                     max_subdivide, n_type{}, tol, prec,
+                                     &panels);
+        for (const auto& [l, r] : panels) { impl::append_nodes(l, r, rule); }
+    };
+
+    if (integration_start_points == 15) {
+        build.template operator()<15>();
+    } else if (integration_start_points == 31) {
+        build.template operator()<31>();
+    } else {
+        throw std::runtime_error(
+            "integration_start_points should be 15 or 31");
+    }
+
+    // map back to [0, inf)
+    for (auto& [x, w] : rule) {
+        const n_type c = std::cos(x);
+        x = std::tan(x);
+        w /= c * c;
+    }
+    return rule;
 }
 
 template <typename Func, typename Tx>
@@ -407,6 +590,119 @@ auto bessel_i_alter_helper(const T& z) {
     return std::array<T, 4>{y0, y1, mu + y0, std::real(z) < 0 ? z : -z};
 }
 
+namespace detail {
+/**
+ * @brief Complex number as a plain pair of doubles. Unlike std::complex, its
+ * multiplication and division never fall back to library calls for NaN/Inf
+ * recovery, so loops over arrays of them vectorize. Division is scaled to
+ * avoid overflow of the squared modulus.
+ *
+ */
+struct plain_complex {
+    double re;
+    double im;
+
+    plain_complex() = default;
+    constexpr plain_complex(double r, double i = 0.) : re(r), im(i) {}
+    plain_complex(const std::complex<double>& c) : re(c.real()), im(c.imag()) {}
+    operator std::complex<double>() const { return {re, im}; }
+
+    friend plain_complex operator+(plain_complex a, plain_complex b) {
+        return {a.re + b.re, a.im + b.im};
+    }
+    friend plain_complex operator-(plain_complex a, plain_complex b) {
+        return {a.re - b.re, a.im - b.im};
+    }
+    friend plain_complex operator*(plain_complex a, plain_complex b) {
+        return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+    }
+    friend plain_complex operator*(double a, plain_complex b) {
+        return {a * b.re, a * b.im};
+    }
+    friend plain_complex inverse(plain_complex a) {
+        const double s = 1. / std::max(std::abs(a.re), std::abs(a.im));
+        const double re = a.re * s;
+        const double im = a.im * s;
+        const double d = s / (re * re + im * im);
+        return {re * d, -im * d};
+    }
+    friend plain_complex operator/(plain_complex a, plain_complex b) {
+        return a * inverse(b);
+    }
+    friend double norm(plain_complex a) { return a.re * a.re + a.im * a.im; }
+};
+}  // namespace detail
+
+/**
+ * @brief Batched bessel_i_alter_helper. The recurrences of all arguments run
+ * in lockstep, lanes that have finished are masked instead of branched, so
+ * that the loops vectorize across arguments.
+ *
+ * @return {y0, y1, mu, z} as bessel_i_alter_helper, each holding N values
+ */
+template <std::size_t N>
+auto bessel_i_alter_batch(const std::array<std::complex<double>, N>& z) {
+    using detail::plain_complex;
+    constexpr double THRESHOLD = 2.e+7;
+
+    std::array<plain_complex, N> z_inv, p0, p1, y0, y1, mu;
+    std::array<double, N> n, test_sq;
+    for (std::size_t k = 0; k < N; ++k) {
+        z_inv[k] = inverse(plain_complex{z[k]});
+        n[k] = std::floor(std::abs(z[k])) + 1;
+        p0[k] = 0.;
+        p1[k] = 1.;
+        const double test_1 = std::max(
+            std::sqrt(THRESHOLD * 2. * n[k] * std::sqrt(norm(z_inv[k]))),
+            THRESHOLD);
+        test_sq[k] = test_1 * test_1;
+    }
+
+    // forward recurrence until p1 is large enough
+    for (bool any_active = true; any_active;) {
+        any_active = false;
+        for (std::size_t k = 0; k < N; ++k) {
+            const bool active = norm(p1[k]) <= test_sq[k];
+            const auto p_tmp = p0[k] - (2. * n[k]) * z_inv[k] * p1[k];
+            p0[k] = active ? p1[k] : p0[k];
+            p1[k] = active ? p_tmp : p1[k];
+            n[k] += active;
+            any_active |= active;
+        }
+    }
+
+    double n_max = 0;
+    for (std::size_t k = 0; k < N; ++k) {
+        y0[k] = inverse(p1[k]);
+        y1[k] = 0.;
+        mu[k] = 0.;
+        n[k] -= 1;
+        n_max = std::max(n_max, n[k]);
+    }
+
+    // backward recurrence, lane k joins when m reaches its own n
+    for (auto m = static_cast<long>(n_max); m > 0; --m) {
+        const double alternate = m & 1 ? -1. : 1.;
+        for (std::size_t k = 0; k < N; ++k) {
+            const bool active = m <= n[k];
+            const auto y_tmp = (2. * m) * z_inv[k] * y0[k] + y1[k];
+            const double sign = std::real(z[k]) < 0 ? alternate : 1.;
+            y1[k] = active ? y0[k] : y1[k];
+            y0[k] = active ? y_tmp : y0[k];
+            mu[k] = active ? mu[k] + (2. * sign) * y1[k] : mu[k];
+        }
+    }
+
+    std::array<std::array<std::complex<double>, N>, 4> result;
+    for (std::size_t k = 0; k < N; ++k) {
+        result[0][k] = y0[k];
+        result[1][k] = y1[k];
+        result[2][k] = mu[k] + y0[k];
+        result[3][k] = std::real(z[k]) < 0 ? z[k] : -z[k];
+    }
+    return result;
+}
+
 // NOTE: When calculating log of bessel_j, the branch is not determined
 template <typename T>
 auto bessel_j_helper(const T& z, bool log = false) {
@@ -4,25 +4,50 @@
 #define lapack_complex_double std::complex<double>
 
 #ifdef EMME_MKL
+#define MKL_Complex8 lapack_complex_float
 #define MKL_Complex16 lapack_complex_double
 #define lapack_int MKL_INT  // This do work
 #endif
 
 // #include <chrono>
+#include <algorithm>
+#include <cmath>
 #include <complex>
+#include <cstddef>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <vector>
 
 #include "DedicatedThreadPool.h"
 #include "Grid.h"
 #include "Matrix.h"
+#include "PackedSymmetricMatrix.h"
 #include "Parameters.h"
 #include "Timer.h"
 #include "aligned-allocator.h"
 #ifdef EMME_MKL
+#include "mkl_blas.h"
 #include "mkl_lapack.h"
 #else
 #include "lapack.h"
+// BLAS routine used by iterative refinement, lapack.h does not declare it.
+// The trailing lengths of side and uplo are hidden arguments of the Fortran
+// ABI, passed as LAPACK_ macros of lapack.h do.
+extern "C" void zsymm_(const char* side,
+                       const char* uplo,
+                       const lapack_int* m,
+                       const lapack_int* n,
+                       const lapack_complex_double* alpha,
+                       const lapack_complex_double* a,
+                       const lapack_int* lda,
+                       const lapack_complex_double* b,
+                       const lapack_int* ldb,
+                       const lapack_complex_double* beta,
+                       lapack_complex_double* c,
+                       const lapack_int* ldc,
+                       std::size_t side_len,
+                       std::size_t uplo_len);
 #endif
 
 using value_type = std::complex<double>;
@@ -44,6 +69,18 @@ class EigenSolver {
    public:
     using value_type = typename T::value_type;
     using matrix_type = T;
+    // full storage, for routines that need both triangles
+    using dense_matrix_type =
+        Matrix<value_type, typename matrix_type::allocator_type>;
+    // LAPACK work arrays, counted as MemoryAccount::workspace, n x n ones
+    // are backed by huge pages
+    template <typename V>
+    using workspace_type =
+        util::huge_page_vector<V, MemoryAccount::workspace>;
+    using workspace_matrix_type =
+        Matrix<value_type,
+               util::AlignedAllocator<value_type, util::Alignment::HUGE_PAGE,
+                                      MemoryAccount::workspace>>;
     // EigenSolver(const Parameters& para_input,
     //             value_type eigen_init,
     //             const Matrix<double>& coeff_matrix_input,
@@ -53,88 +90,132 @@ class EigenSolver {
         eigen_matrix_derivative =
             (eigen_matrix - eigen_matrix_old) / d_eigen_value;
     };
+    /**
+     * @brief Kernel vector of eigen matrix, with unit 2-norm. Inverse
+     * iteration on a symmetric factorization is tried first, full SVD is
+     * the fallback.
+     *
+     */
     std::vector<value_type> nullSpace() {
-        auto A = eigen_matrix;
-        // Check if the matrix is square
-        if (A.getRows() != A.getCols()) {
-            throw std::invalid_argument("Input matrix must be square.");
+        if (auto kernel_vector = nullSpaceInverseIteration()) {
+            return *std::move(kernel_vector);
         }
+        return nullSpaceSVD();
+    }
+
+    std::vector<value_type> nullSpaceSVD() {
+        auto A = denseEigenMatrix();
 
         // Perform Singular Value Decomposition (SVD)
-        // You'll need an external library like Eigen or LAPACK for SVD
-        // Replace this placeholder with your preferred SVD implementation
-        // which returns the singular values (S), left singular vectors (U),
-        // and right singular vectors (V)
-        std::vector<double> S(A.getRows());  // why S is real??
-        matrix_type U(A.getRows(), A.getRows());
+        workspace_type<double> S(A.getRows());
+        workspace_matrix_type U(A.getRows(), A.getRows());
 
-        matrix_type VT(A.getCols(), A.getCols());
+        workspace_matrix_type VT(A.getCols(), A.getCols());
 
         const char* jobz = "All";
         const lapack_int dimm = A.getRows();
         const lapack_int dimn = A.getCols();
 
-        lapack_int work_length = dimm;
-        // lapack_int optimal_work_length{};
-        lapack_int lwork = 2 * work_length * work_length;
-        std::vector<value_type> work(lwork);
-        std::vector<double> rwork(50 * work_length * work_length);
-        std::vector<int> iwork(8 * work_length);
+        // workspace size required by zgesdd for square matrix
+        const std::size_t work_length = dimm;
+        workspace_type<double> rwork(5 * work_length * work_length +
+                                     5 * work_length);
+        workspace_type<lapack_int> iwork(8 * work_length);
 
         lapack_int info{};
+        lapack_int lwork = -1;
+        workspace_type<value_type> work(1);
 
-        // const char* jobu = "None";
-        // const char* jobvt = "All";
-        // LAPACK_zgesvd(jobu, jobvt, &dimm, &dimn, A.data(), &dimm, S.data(),
-        //               U.data(), &dimm, VT.data(), &dimm, work.data(), &lwork,
-        //               rwork.data(), &info);
-
+        // query optimal work length first, then do the decomposition
         // zgesdd is much faster than zgesvd
+        for (int pass = 0; pass < 2; ++pass) {
 #ifdef EMME_MKL
-        zgesdd(jobz, &dimm, &dimn, A.data(), &dimm, S.data(), U.data(), &dimm,
-               VT.data(), &dimm, work.data(), &lwork, rwork.data(),
-               iwork.data(), &info);
-
+            zgesdd(jobz, &dimm, &dimn, A.data(), &dimm, S.data(), U.data(),
+                   &dimm, VT.data(), &dimm, work.data(), &lwork, rwork.data(),
+                   iwork.data(), &info);
 #else
-        LAPACK_zgesdd(jobz, &dimm, &dimn, A.data(), &dimm, S.data(), U.data(),
-                      &dimm, VT.data(), &dimm, work.data(), &lwork,
-                      rwork.data(), iwork.data(), &info);
+            LAPACK_zgesdd(jobz, &dimm, &dimn, A.data(), &dimm, S.data(),
+                          U.data(), &dimm, VT.data(), &dimm, work.data(),
+                          &lwork, rwork.data(), iwork.data(), &info);
 #endif
+            lwork = static_cast<lapack_int>(work[0].real());
+            work.resize(lwork);
+        }
+        if (info != 0) {
+            throw std::runtime_error("SVD of eigen matrix failed.");
+        }
+
         // lapack is coloum major order but we are Row major order, VT is not V
         auto kernel_vector = VT.getCol(VT.getCols() - 1);
 
         for (auto& ele : kernel_vector) { ele = std::conj(ele); }
+        normalizeKernelVector(kernel_vector);
 
         return kernel_vector;
-        ;
     };
+
+    // Newton iteration on det(eigen_matrix) = 0, the derivative matrix is
+    // either from secant or analytic, see Parameters::analytic_derivative
     void newtonTraceSecantIteration() {
-        eigen_matrix_old = eigen_matrix;
+        if (!para.analytic_derivative) { eigen_matrix_old = eigen_matrix; }
         const char* upper = "Upper";
         const lapack_int dim = eigen_matrix.getRows();
-        lapack_int work_length = dim * dim;
-        lapack_int optimal_work_length{};
-        std::vector<value_type> work(work_length);
-        std::vector<lapack_int> ipiv(dim);
+        auto& work = newton_workspace.work;
+        auto& ipiv = newton_workspace.ipiv;
+        // zsptri only needs a vector of workspace, zsysv may ask for more
+        const std::size_t min_work_length =
+            is_packed_symmetric_v<matrix_type> ? dim : dim * dim;
+        if (work.size() < min_work_length) { work.resize(min_work_length); }
+        ipiv.resize(dim);
+        lapack_int work_length = work.size();
         lapack_int info{};
 
-        if (optimal_work_length > work_length) {
-            work_length = optimal_work_length;
-            work.resize(work_length);
-        }
-
-        Timer::get_timer().start_timing("linear solver");
+        static const auto linear_solver_zone = Timer::intern("linear solver");
+        std::optional<Timer::Zone> zone(std::in_place, linear_solver_zone);
+        if constexpr (is_packed_symmetric_v<matrix_type>) {
+            // A packed solve would need a dense right hand side, instead
+            // form the packed inverse, trace(A^-1 A') is then a sum of
+            // element-wise products of two symmetric matrices.
 #ifdef EMME_MKL
-        zsysv(upper, &dim, &dim, eigen_matrix.data(), &dim, ipiv.data(),
-              eigen_matrix_derivative.data(), &dim, work.data(), &work_length,
-              &info);
+            zsptrf(upper, &dim, eigen_matrix.data(), ipiv.data(), &info);
+            if (info == 0) {
+                zsptri(upper, &dim, eigen_matrix.data(), ipiv.data(),
+                       work.data(), &info);
+            }
+#else
+            LAPACK_zsptrf(upper, &dim, eigen_matrix.data(), ipiv.data(),
+                          &info);
+            if (info == 0) {
+                LAPACK_zsptri(upper, &dim, eigen_matrix.data(), ipiv.data(),
+                              work.data(), &info);
+            }
+#endif
+            d_eigen_value =
+                -1.0 / trace_product(eigen_matrix, eigen_matrix_derivative);
+        } else {
+            std::optional<value_type> trace;
+            if (para.mixed_precision) { trace = mixedPrecisionTrace(); }
+            if (!trace) {
+#ifdef EMME_MKL
+                zsysv(upper, &dim, &dim, eigen_matrix.data(), &dim,
+                      ipiv.data(), eigen_matrix_derivative.data(), &dim,
+                      work.data(), &work_length, &info);
 #else
-        LAPACK_zsysv(upper, &dim, &dim, eigen_matrix.data(), &dim, ipiv.data(),
-                     eigen_matrix_derivative.data(), &dim, work.data(),
-                     &work_length, &info);
+                LAPACK_zsysv(upper, &dim, &dim, eigen_matrix.data(), &dim,
+                             ipiv.data(), eigen_matrix_derivative.data(), &dim,
+                             work.data(), &work_length, &info);
 #endif
-        Timer::get_timer().pause_timing("linear solver");
-        d_eigen_value = -1.0 / eigen_matrix_derivative.trace();
+                trace = eigen_matrix_derivative.trace();
+                // optimal length, for the next iteration
+                const auto optimal_work_length =
+                    static_cast<std::size_t>(work[0].real());
+                if (info == 0 && optimal_work_length > work.size()) {
+                    work.resize(optimal_work_length);
+                }
+            }
+            d_eigen_value = -1.0 / *trace;
+        }
+        zone.reset();
         eigen_value += d_eigen_value;
 
         if (info != 0) {
@@ -150,11 +231,15 @@ class EigenSolver {
             throw std::runtime_error(oss.str());
         };
 
-        optimal_work_length = work[0].real();
-        Timer::get_timer().start_timing("integration");
-        matrixAssembler(eigen_matrix);
-        Timer::get_timer().pause_timing("integration");
-        matrixDerivativeSecantAssembler();
+        static const auto integration_zone = Timer::intern("integration");
+        zone.emplace(integration_zone);
+        if (para.analytic_derivative) {
+            matrixAssembler(eigen_matrix, &eigen_matrix_derivative);
+        } else {
+            matrixAssembler(eigen_matrix);
+        }
+        zone.reset();
+        if (!para.analytic_derivative) { matrixDerivativeSecantAssembler(); }
     }
     const Parameters& para;
     value_type eigen_value;
@@ -180,112 +265,610 @@ class EigenSolver {
           dim(std::fpclassify(para.beta_e) == FP_ZERO ? grid_info.npoints
                                                       : 2 * grid_info.npoints),
           eigen_matrix(dim, dim),
-          eigen_matrix_old(dim, dim),
+          // only the secant needs it
+          eigen_matrix_old(para_input.analytic_derivative ? 0 : dim,
+                           para_input.analytic_derivative ? 0 : dim),
           eigen_matrix_derivative(dim, dim) {
+        if (para.analytic_derivative) {
+            // no need to bootstrap the secant
+            eigen_value = eigen_init;
+            matrixAssembler(eigen_matrix, &eigen_matrix_derivative);
+            return;
+        }
         matrixAssembler(eigen_matrix_old);
         eigen_value += d_eigen_value;
         matrixAssembler(eigen_matrix);
         matrixDerivativeSecantAssembler();
     }
 
-    void matrixAssembler(matrix_type& mat) {
+    /**
+     * @brief Set up without any assembly nor the matrices Newton iteration
+     * needs, for solvers that only evaluate eigen matrix at given omega, see
+     * assembleAt.
+     *
+     */
+    EigenSolver(const Parameters& para_input,
+                const Matrix<double>& coeff_matrix_input,
+                const Grid<double>& grid_info_input)
+        : para(para_input),
+          eigen_value{},
+          d_eigen_value{},
+          null_space_tol(1e-1),
+          coeff_matrix(coeff_matrix_input),
+          grid_info(grid_info_input),
+          dim(std::fpclassify(para.beta_e) == FP_ZERO ? grid_info.npoints
+                                                      : 2 * grid_info.npoints),
+          eigen_matrix(dim, dim),
+          eigen_matrix_old(0, 0),
+          eigen_matrix_derivative(0, 0) {}
+
+    // Assemble eigen_matrix at omega, which becomes eigen_value
+    void assembleAt(value_type omega) {
+        eigen_value = omega;
+        matrixAssembler(eigen_matrix);
+    }
+
+    /**
+     * @brief Read kernel samples of owner instead of building its own, so
+     * that solvers assembling at the same time share one cache. Owner must
+     * have assembled at an omega with the same sign of Re(omega) as this
+     * one assembles at, and must not assemble at the other sign meanwhile.
+     *
+     */
+    void shareKernelSamples(const EigenSolver& owner) {
+        kernel_samples_owner = &owner;
+    }
+
+    /**
+     * @brief Assemble eigen matrix at current eigen value, and also its
+     * derivative to eigen value if derivative is not null.
+     *
+     */
+    void matrixAssembler(matrix_type& mat, matrix_type* derivative = nullptr) {
 #ifdef EMME_DEBUG
 
         if (mat.getRows() != dim || mat.getCols() != dim) {
             throw std::runtime_error(
                 "Matrix dimension and grid length mismatch.");
         }
+        if (grid_info.geometry.size() != grid_info.npoints) {
+            throw std::runtime_error("Grid geometry is not tabulated.");
+        }
 
 #endif
+        const unsigned int n = grid_info.npoints;
+        const bool electromagnetic = std::fpclassify(para.beta_e) != FP_ZERO;
+
+        for (unsigned int i = 0; i < n; i++) {
+            mat(i, i) = (1.0 + 1.0 / para.tau);
+            if (electromagnetic) {
+                mat(i, i + n) = 0.0;
+                mat(i + n, i) = 0.0;
+                mat(i + n, i + n) =
+                    (2.0 * para.tau) / para.beta_e * grid_info.geometry[i].bi;
+            }
+            if (derivative) {
+                auto& dmat = *derivative;
+                dmat(i, i) = 0.0;
+                if (electromagnetic) {
+                    dmat(i, i + n) = 0.0;
+                    dmat(i + n, i) = 0.0;
+                    dmat(i + n, i + n) = 0.0;
+                }
+            }
+        }
 
-        static auto kappa_f_tau_all = [&](unsigned i, double eta, double eta_p,
-                                          std::complex<double> omega) {
-            return para.kappa_f_tau(i, eta, eta_p, omega) +
-                   para.kappa_f_tau_e(i, eta, eta_p, omega);
-        };
+        if (para.kernel_cache && kernel_samples_owner) {
+#ifdef EMME_DEBUG
+            if (kernel_samples_owner->kernel_samples.empty() ||
+                std::signbit(eigen_value.real()) !=
+                    kernel_samples_owner->kernel_samples_sign) {
+                throw std::runtime_error(
+                    "Shared kernel samples are for the other sign of "
+                    "Re(omega).");
+            }
+#endif
+        } else if (para.kernel_cache) {
+            // the integration contour depends on the sign of Re(omega)
+            const bool sign = std::signbit(eigen_value.real());
+            if (kernel_samples.empty() || sign != kernel_samples_sign) {
+                kernel_samples.assign(n * (n - 1) / 2, {});
+                kernel_samples_sign = sign;
+            }
+        }
 
+        const auto tiles = assemblyTiles();
 #ifdef MULTI_THREAD
-        auto& thread_pool = DedicatedThreadPool<void>::get_instance();
-
-        std::vector<std::future<void>> res;
+        DedicatedThreadPool<void>::get_instance().parallel_for(
+            std::size_t{0}, tiles.size(), std::size_t{1},
+            [&](std::size_t begin, std::size_t end) {
+                for (auto i = begin; i < end; ++i) {
+                    assembleTile(mat, derivative, tiles[i], electromagnetic);
+                }
+            });
+#else
+        for (const auto& tile : tiles) {
+            assembleTile(mat, derivative, tile, electromagnetic);
+        }
 #endif
+    }
 
-        if (std::fpclassify(para.beta_e) == FP_ZERO) {
-            for (unsigned int i = 0; i < grid_info.npoints; i++) {
-                for (unsigned int j = i; j < grid_info.npoints; j++) {
-                    if (i == j) {
-                        mat(i, j) = (1.0 + 1.0 / para.tau);
-                    } else {
-#ifdef MULTI_THREAD
-                        res.push_back(thread_pool.queue_task([&, i, j]() {
+    // Unit 2-norm with the element of largest modulus real positive, so that
+    // the kernel vector has the same phase whichever way it is found. Return
+    // false if x is zero or not finite.
+    static bool normalizeKernelVector(std::vector<value_type>& x) {
+        double norm_sq = 0.;
+        std::size_t max_idx = 0;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            norm_sq += std::norm(x[i]);
+            if (std::norm(x[i]) > std::norm(x[max_idx])) { max_idx = i; }
+        }
+        if (!(std::isfinite(norm_sq) && norm_sq > 0.)) { return false; }
+        const auto scale =
+            std::conj(x[max_idx]) / (std::abs(x[max_idx]) * std::sqrt(norm_sq));
+        for (auto& v : x) { v *= scale; }
+        return true;
+    }
+
+   private:
+    /**
+     * @brief Inverse iteration x <- A^-1 x on LDL^T factorization of eigen
+     * matrix. Eigen matrix is nearly singular after Newton iteration
+     * converges, so that this converges in very few steps. Phase is fixed
+     * by making the element of largest modulus real positive.
+     *
+     * @return nothing if factorization fails (A exactly singular) or
+     * iteration does not converge
+     */
+    std::optional<std::vector<value_type>> nullSpaceInverseIteration() {
+        constexpr int MAX_ITER = 8;
+        constexpr double TOL = 1e-10;
+
+        const lapack_int n = eigen_matrix.getRows();
+        const char* upper = "Upper";
+        auto factorized = eigen_matrix;
+        workspace_type<lapack_int> ipiv(n);
+        lapack_int info{};
+        lapack_int lwork = -1;
+        workspace_type<value_type> work(1);
+
+        if constexpr (is_packed_symmetric_v<matrix_type>) {
+#ifdef EMME_MKL
+            zsptrf(upper, &n, factorized.data(), ipiv.data(), &info);
+#else
+            LAPACK_zsptrf(upper, &n, factorized.data(), ipiv.data(), &info);
 #endif
-                            mat(i, j) = -kappa_f_tau_all(0, grid_info.grid[i],
-                                                         grid_info.grid[j],
-                                                         eigen_value) *
-                                        coeff_matrix(i, j) * grid_info.dx;
+        } else {
+            for (int pass = 0; pass < 2; ++pass) {
+#ifdef EMME_MKL
+                zsytrf(upper, &n, factorized.data(), &n, ipiv.data(),
+                       work.data(), &lwork, &info);
+#else
+                LAPACK_zsytrf(upper, &n, factorized.data(), &n, ipiv.data(),
+                              work.data(), &lwork, &info);
+#endif
+                lwork = std::max<lapack_int>(1, work[0].real());
+                work.resize(lwork);
+            }
+        }
+        if (info != 0) { return {}; }
 
-                            mat(j, i) = mat(i, j);
-#ifdef MULTI_THREAD
-                        }));
+        auto solve = [&](std::vector<value_type>& x) {
+            const lapack_int nrhs = 1;
+            if constexpr (is_packed_symmetric_v<matrix_type>) {
+#ifdef EMME_MKL
+                zsptrs(upper, &n, &nrhs, factorized.data(), ipiv.data(),
+                       x.data(), &n, &info);
+#else
+                LAPACK_zsptrs(upper, &n, &nrhs, factorized.data(),
+                              ipiv.data(), x.data(), &n, &info);
+#endif
+            } else {
+#ifdef EMME_MKL
+                zsytrs(upper, &n, &nrhs, factorized.data(), &n, ipiv.data(),
+                       x.data(), &n, &info);
+#else
+                LAPACK_zsytrs(upper, &n, &nrhs, factorized.data(), &n,
+                              ipiv.data(), x.data(), &n, &info);
 #endif
-                    }
-                }
             }
+            return info == 0;
+        };
+        // not likely to be orthogonal to the kernel vector
+        std::vector<value_type> x(n);
+        for (lapack_int i = 0; i < n; ++i) {
+            x[i] = 1. + static_cast<double>(i) / n;
+        }
+        normalizeKernelVector(x);
+        for (int iter = 0; iter < MAX_ITER; ++iter) {
+            auto x_new = x;
+            if (!solve(x_new) || !normalizeKernelVector(x_new)) { return {}; }
+            double diff_sq = 0.;
+            for (lapack_int i = 0; i < n; ++i) {
+                diff_sq += std::norm(x_new[i] - x[i]);
+            }
+            x = std::move(x_new);
+            if (diff_sq < TOL * TOL) { return x; }
+        }
+        return {};
+    }
 
-        } else {
-            for (unsigned int i = 0; i < grid_info.npoints; i++) {
-                for (unsigned int j = i; j < grid_info.npoints; j++) {
-                    if (i == j) {
-                        mat(i, j) = (1.0 + 1.0 / para.tau);
-                        mat(i, j + grid_info.npoints) = 0.0;
-                        mat(i + grid_info.npoints, j) = 0.0;
-                        mat(i + grid_info.npoints, j + grid_info.npoints) =
-                            (2.0 * para.tau) / para.beta_e *
-                            para.bi(grid_info.grid[i]);
-
-                    } else {
-#ifdef MULTI_THREAD
-                        res.push_back(thread_pool.queue_task([&, i, j]() {
+    /**
+     * @brief trace(A^-1 A') with A factorized in single precision.
+     *
+     * An inexact trace only makes Newton iteration converge slower, not to
+     * a different eigenvalue, so the single precision result is used as is
+     * while Newton step is large. Once the step is small, X = A^-1 A' is
+     * refined in double precision until its residual A' - A X is at the
+     * level of double precision round-off, with the same criterion as LAPACK
+     * zcgesv. Each refinement sweep costs a double precision matrix product,
+     * comparable to a double precision solve, hence not done every step.
+     *
+     * @return nothing if A does not fit in single precision, the single
+     * precision factorization fails or refinement stalls (A is too ill
+     * conditioned for single precision, as it is close to convergence), then
+     * caller should solve in double precision.
+     */
+    std::optional<value_type> mixedPrecisionTrace() {
+        using float_type = std::complex<float>;
+        constexpr int MAX_REFINE_ITER = 30;
+        // relative Newton step below which the trace is refined
+        constexpr double REFINE_STEP = 1e-3;
+        // a sweep costs about a double precision solve, give up if residual
+        // is not reduced fast enough
+        constexpr double STALL_RATIO = 0.1;
+
+        const lapack_int n = eigen_matrix.getRows();
+        const std::size_t nn = static_cast<std::size_t>(n) * n;
+        const char* upper = "Upper";
+
+        // A and A' are symmetric, row major storage can be used as is
+        const auto* a = eigen_matrix.data();
+        const auto* b = eigen_matrix_derivative.data();
+
+        double a_norm = 0.;
+        for (std::size_t i = 0; i < nn; ++i) {
+            a_norm = std::max(a_norm, std::abs(a[i]));
+        }
+        if (a_norm > std::numeric_limits<float>::max()) { return {}; }
+
+        auto& a_single = newton_workspace.a_single;
+        auto& ipiv = newton_workspace.ipiv;
+        auto& work = newton_workspace.work_single;
+        a_single.assign(a, a + nn);
+        ipiv.resize(n);
+        lapack_int info{};
+        lapack_int lwork = -1;
+        float_type work_query{};
+#ifdef EMME_MKL
+        csytrf(upper, &n, a_single.data(), &n, ipiv.data(), &work_query,
+               &lwork, &info);
+#else
+        LAPACK_csytrf(upper, &n, a_single.data(), &n, ipiv.data(),
+                      &work_query, &lwork, &info);
 #endif
-                            mat(i, j) = -kappa_f_tau_all(0, grid_info.grid[i],
-                                                         grid_info.grid[j],
-                                                         eigen_value) *
-                                        coeff_matrix(i, j) * grid_info.dx;
-                            mat(i, j + grid_info.npoints) =
-                                kappa_f_tau_all(1, grid_info.grid[i],
-                                                grid_info.grid[j],
-                                                eigen_value) *
-                                grid_info.dx;
-
-                            mat(i + grid_info.npoints, j + grid_info.npoints) =
-                                kappa_f_tau_all(2, grid_info.grid[i],
-                                                grid_info.grid[j],
-                                                eigen_value) *
-                                grid_info.dx;
-
-                            mat(j, i) = mat(i, j);
-
-                            mat(j, i + grid_info.npoints) =
-                                -mat(i, j + grid_info.npoints);
-                            mat(j + grid_info.npoints, i + grid_info.npoints) =
-                                mat(i + grid_info.npoints,
-                                    j + grid_info.npoints);
-
-                            mat(i + grid_info.npoints, j) =
-                                mat(j, i + grid_info.npoints);
-
-                            mat(j + grid_info.npoints, i) =
-                                mat(i, j + grid_info.npoints);
-#ifdef MULTI_THREAD
-                        }));
+        // csytrs2 needs n of workspace
+        lwork = std::max<lapack_int>(n, work_query.real());
+        if (work.size() < static_cast<std::size_t>(lwork)) {
+            work.resize(lwork);
+        }
+#ifdef EMME_MKL
+        csytrf(upper, &n, a_single.data(), &n, ipiv.data(), work.data(),
+               &lwork, &info);
+#else
+        LAPACK_csytrf(upper, &n, a_single.data(), &n, ipiv.data(),
+                      work.data(), &lwork, &info);
 #endif
-                    }
-                }
+        if (info != 0) { return {}; }
+
+        // correction = A^-1 rhs in single precision, in place
+        auto& correction = newton_workspace.correction;
+        correction.assign(b, b + nn);
+        auto solve_single = [&]() {
+#ifdef EMME_MKL
+            csytrs2(upper, &n, &n, a_single.data(), &n, ipiv.data(),
+                    correction.data(), &n, work.data(), &info);
+#else
+            LAPACK_csytrs2(upper, &n, &n, a_single.data(), &n, ipiv.data(),
+                           correction.data(), &n, work.data(), &info);
+#endif
+            return info == 0;
+        };
+        if (!solve_single()) { return {}; }
+        value_type single_trace{};
+        for (lapack_int i = 0; i < n; ++i) {
+            single_trace += value_type(correction[i * (n + 1)]);
+        }
+        if (std::abs(single_trace) * REFINE_STEP * std::abs(eigen_value) < 1.) {
+            return single_trace;
+        }
+
+        auto& x = newton_workspace.x;
+        auto& residual = newton_workspace.residual;
+        x.assign(correction.begin(), correction.end());
+        residual.resize(nn);
+
+        const double tolerance = a_norm *
+                                 std::numeric_limits<double>::epsilon() *
+                                 std::sqrt(static_cast<double>(n));
+        const value_type minus_one{-1.};
+        const value_type one{1.};
+        double last_r_norm = std::numeric_limits<double>::infinity();
+        for (int iter = 0; iter < MAX_REFINE_ITER; ++iter) {
+            // residual = A' - A X
+            std::copy(b, b + nn, residual.begin());
+#ifdef EMME_MKL
+            zsymm("Left", upper, &n, &n, &minus_one, a, &n, x.data(), &n, &one,
+                  residual.data(), &n);
+#else
+            zsymm_("Left", upper, &n, &n, &minus_one, a, &n, x.data(), &n,
+                   &one, residual.data(), &n, 1, 1);
+#endif
+            double x_norm = 0.;
+            double r_norm = 0.;
+            for (std::size_t i = 0; i < nn; ++i) {
+                x_norm = std::max(x_norm, std::abs(x[i]));
+                r_norm = std::max(r_norm, std::abs(residual[i]));
+            }
+            if (r_norm < x_norm * tolerance) {
+                value_type trace{};
+                for (lapack_int i = 0; i < n; ++i) { trace += x[i * (n + 1)]; }
+                return trace;
+            }
+            if (r_norm > STALL_RATIO * last_r_norm) { return {}; }
+            last_r_norm = r_norm;
+
+            std::copy(residual.begin(), residual.end(), correction.begin());
+            if (!solve_single()) { return {}; }
+            for (std::size_t i = 0; i < nn; ++i) {
+                x[i] += value_type(correction[i]);
             }
         }
+        return {};
+    }
+
+    /**
+     * @brief A square block of the upper triangle, [row_begin, row_end) x
+     * [col_begin, col_end) with col_begin >= row_begin.
+     *
+     */
+    struct AssemblyTile {
+        unsigned int row_begin;
+        unsigned int row_end;
+        unsigned int col_begin;
+        unsigned int col_end;
+        std::size_t cost;  // number of off-diagonal elements inside
+    };
+
+    /**
+     * @brief Split the strict upper triangle into square tiles, one task per
+     * tile. Tile size is shrunk until there are enough tiles to keep every
+     * thread busy, and tiles are ordered by decreasing cost so that the
+     * cheap (diagonal and edge) tiles fill the gaps at the end.
+     *
+     */
+    std::vector<AssemblyTile> assemblyTiles() const {
+        const unsigned int n = grid_info.npoints;
 #ifdef MULTI_THREAD
-        for (auto& f : res) { f.get(); }
+        const std::size_t min_tile_num =
+            8 * DedicatedThreadPool<void>::get_instance().thread_num();
+#else
+        const std::size_t min_tile_num = 1;
 #endif
+        unsigned int tile_size = MAX_TILE_SIZE;
+        auto tile_count = [&](unsigned int ts) {
+            const std::size_t nb = (n + ts - 1) / ts;
+            return nb * (nb + 1) / 2;
+        };
+        while (tile_size > MIN_TILE_SIZE &&
+               tile_count(tile_size) < min_tile_num) {
+            tile_size /= 2;
+        }
+
+        std::vector<AssemblyTile> tiles;
+        tiles.reserve(tile_count(tile_size));
+        for (unsigned int rb = 0; rb < n; rb += tile_size) {
+            const auto re = std::min(rb + tile_size, n);
+            for (unsigned int cb = rb; cb < n; cb += tile_size) {
+                const auto ce = std::min(cb + tile_size, n);
+                std::size_t cost = 0;
+                for (auto i = rb; i < re; ++i) {
+                    cost += ce - std::max(cb, i + 1);
+                }
+                if (cost != 0) { tiles.push_back({rb, re, cb, ce, cost}); }
+            }
+        }
+        std::stable_sort(
+            tiles.begin(), tiles.end(),
+            [](const auto& a, const auto& b) { return a.cost > b.cost; });
+
+        return tiles;
+    }
+
+    const Parameters::kernel_samples_type& kernelSamples(unsigned int i,
+                                                         unsigned int j) {
+        // index of (i, j) in the strict upper triangle
+        const unsigned int n = grid_info.npoints;
+        const auto index = i * n - i * (i + 1) / 2 + (j - i - 1);
+        // the owner has filled every element
+        if (kernel_samples_owner) {
+            return kernel_samples_owner->kernel_samples[index];
+        }
+        auto& samples = kernel_samples[index];
+        if (samples.empty()) {
+            samples = para.kappa_f_tau_samples(
+                grid_info.geometry[i], grid_info.geometry[j], eigen_value);
+        }
+        return samples;
+    }
+
+    std::complex<double> kappaAll(unsigned int i, unsigned int j) {
+        const auto& node = grid_info.geometry[i];
+        const auto& node_p = grid_info.geometry[j];
+        return (para.kernel_cache
+                    ? para.kappa_f_tau(0, kernelSamples(i, j), eigen_value)
+                    : para.kappa_f_tau(0, node, node_p, eigen_value)) +
+               para.kappa_f_tau_e(0, node, node_p, eigen_value);
+    }
+
+    Parameters::kappa_derivative_type kappaAllWithDerivative(unsigned int i,
+                                                             unsigned int j) {
+        const auto& node = grid_info.geometry[i];
+        const auto& node_p = grid_info.geometry[j];
+        auto result = para.kernel_cache
+                          ? para.kappa_f_tau_with_derivative(
+                                0, kernelSamples(i, j), eigen_value)
+                          : para.kappa_f_tau_with_derivative(0, node, node_p,
+                                                             eigen_value);
+        result[0] += para.kappa_f_tau_e(0, node, node_p, eigen_value);
+        result[1] +=
+            para.kappa_f_tau_e_derivative(0, node, node_p, eigen_value);
+        return result;
+    }
+
+    // m = 0, 1, 2 moments from a single quadrature
+    Parameters::kappa_moments_type kappaAllMoments(unsigned int i,
+                                                   unsigned int j) {
+        const auto& node = grid_info.geometry[i];
+        const auto& node_p = grid_info.geometry[j];
+        auto moments =
+            para.kernel_cache
+                ? para.kappa_f_tau_moments(kernelSamples(i, j), eigen_value)
+                : para.kappa_f_tau_moments(node, node_p, eigen_value);
+        for (unsigned int m = 0; m < 3; ++m) {
+            moments[m] += para.kappa_f_tau_e(m, node, node_p, eigen_value);
+        }
+        return moments;
+    }
+
+    // m = 0, 1, 2 moments then their derivatives, from a single quadrature
+    Parameters::kappa_moments_derivative_type kappaAllMomentsWithDerivative(
+        unsigned int i,
+        unsigned int j) {
+        const auto& node = grid_info.geometry[i];
+        const auto& node_p = grid_info.geometry[j];
+        auto result = para.kernel_cache
+                          ? para.kappa_f_tau_moments_with_derivative(
+                                kernelSamples(i, j), eigen_value)
+                          : para.kappa_f_tau_moments_with_derivative(
+                                node, node_p, eigen_value);
+        for (unsigned int m = 0; m < 3; ++m) {
+            result[m] += para.kappa_f_tau_e(m, node, node_p, eigen_value);
+            result[m + 3] +=
+                para.kappa_f_tau_e_derivative(m, node, node_p, eigen_value);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Fill the upper triangle elements inside one tile row by row,
+     * then write the mirrored lower triangle elements, also row by row, so
+     * that the strided access stays within the tile. The derivative matrix,
+     * if any, is filled from the same quadratures.
+     *
+     */
+    void assembleTile(matrix_type& mat,
+                      matrix_type* derivative,
+                      const AssemblyTile& tile,
+                      bool electromagnetic) {
+        // load balance of tiles shows in per-thread times
+        static const auto zone_id = Timer::intern("assembly tile");
+        Timer::Zone zone(zone_id);
+        const auto [rb, re, cb, ce, cost] = tile;
+
+        for (auto i = rb; i < re; ++i) {
+            for (auto j = std::max(cb, i + 1); j < ce; ++j) {
+                if (electromagnetic && derivative) {
+                    const auto k = kappaAllMomentsWithDerivative(i, j);
+                    setElements(mat, i, j, k[0], k[1], k[2]);
+                    setElements(*derivative, i, j, k[3], k[4], k[5]);
+                } else if (electromagnetic) {
+                    const auto k = kappaAllMoments(i, j);
+                    setElements(mat, i, j, k[0], k[1], k[2]);
+                } else if (derivative) {
+                    const auto k = kappaAllWithDerivative(i, j);
+                    setElements(mat, i, j, k[0]);
+                    setElements(*derivative, i, j, k[1]);
+                } else {
+                    setElements(mat, i, j, kappaAll(i, j));
+                }
+            }
+        }
+
+        // packed storage holds each symmetric pair only once
+        if constexpr (!is_packed_symmetric_v<matrix_type>) {
+            mirrorTile(mat, tile, electromagnetic);
+            if (derivative) { mirrorTile(*derivative, tile, electromagnetic); }
+        }
+    }
+
+    // upper triangle elements of (i, j), i < j, from kappa moments
+    void setElements(matrix_type& mat,
+                     unsigned int i,
+                     unsigned int j,
+                     std::complex<double> k0) {
+        mat(i, j) = -k0 * coeff_matrix(i, j) * grid_info.dx;
+    }
+
+    void setElements(matrix_type& mat,
+                     unsigned int i,
+                     unsigned int j,
+                     std::complex<double> k0,
+                     std::complex<double> k1,
+                     std::complex<double> k2) {
+        const unsigned int n = grid_info.npoints;
+        setElements(mat, i, j, k0);
+        mat(i, j + n) = k1 * grid_info.dx;
+        mat(i + n, j) = -mat(i, j + n);
+        mat(i + n, j + n) = k2 * grid_info.dx;
     }
+
+    void mirrorTile(matrix_type& mat,
+                    const AssemblyTile& tile,
+                    bool electromagnetic) {
+        const unsigned int n = grid_info.npoints;
+        const auto [rb, re, cb, ce, cost] = tile;
+        for (auto j = cb; j < ce; ++j) {
+            for (auto i = rb; i < std::min(re, j); ++i) {
+                mat(j, i) = mat(i, j);
+                if (electromagnetic) {
+                    mat(j + n, i + n) = mat(i + n, j + n);
+                    mat(j, i + n) = -mat(i, j + n);
+                    mat(j + n, i) = mat(i, j + n);
+                }
+            }
+        }
+    }
+
+    dense_matrix_type denseEigenMatrix() const {
+        if constexpr (is_packed_symmetric_v<matrix_type>) {
+            return eigen_matrix.template unpack<dense_matrix_type>();
+        } else {
+            return eigen_matrix;
+        }
+    }
+
+    // omega-independent integrand factors on a fixed quadrature rule, for
+    // each element of the strict upper triangle, built on first use
+    std::vector<Parameters::kernel_samples_type> kernel_samples;
+    bool kernel_samples_sign{};
+    // see shareKernelSamples
+    const EigenSolver* kernel_samples_owner{};
+
+    // work arrays of newtonTraceSecantIteration and mixedPrecisionTrace,
+    // kept across iterations so that the n x n ones are not mapped again
+    // every step
+    struct {
+        workspace_type<value_type> work;
+        workspace_type<lapack_int> ipiv;
+        workspace_type<std::complex<float>> a_single;
+        workspace_type<std::complex<float>> work_single;
+        workspace_type<std::complex<float>> correction;
+        workspace_type<value_type> x;
+        workspace_type<value_type> residual;
+    } newton_workspace;
+
+    static constexpr unsigned int MAX_TILE_SIZE = 32;
+    static constexpr unsigned int MIN_TILE_SIZE = 4;
 };
 #endif  // SOLVER_H
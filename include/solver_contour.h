@@ -0,0 +1,365 @@
+#ifndef SOLVER_CONTOUR_H
+#define SOLVER_CONTOUR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "DedicatedThreadPool.h"
+#include "Grid.h"
+#include "Matrix.h"
+#include "Parameters.h"
+#include "Timer.h"
+#include "solver.h"
+
+/**
+ * @brief Find every eigenvalue inside a circle in omega plane by Beyn's
+ * contour integral method.
+ *
+ * The moments A_p = 1/(2 pi i) \oint z^p K(omega)^-1 V d omega, p = 0, 1,
+ * of eigen matrix K on a random probe block V are approximated by trapezoid
+ * rule on N points of the circle, z = (omega - center) / radius. The
+ * eigenvalues inside are those of the small matrix U^H A_1 W S^-1 from the
+ * thin SVD A_0 = U S W^H, and kernel vectors are U times its eigenvectors.
+ *
+ * Number of probe vectors must not be less than the number of eigenvalues
+ * inside the contour, see rank().
+ */
+template <typename T>
+class ContourSolver {
+   public:
+    using value_type = typename T::value_type;
+    using matrix_type = T;
+    // counted as MemoryAccount::workspace, large ones backed by huge pages
+    template <typename V>
+    using workspace_type =
+        util::huge_page_vector<V, MemoryAccount::workspace>;
+
+    struct EigenPair {
+        value_type eigen_value;
+        std::vector<value_type> eigen_vector;
+    };
+
+    ContourSolver(const Parameters& para_input,
+                  const Matrix<double>& coeff_matrix_input,
+                  const Grid<double>& grid_info_input,
+                  value_type center_input,
+                  double radius_input,
+                  unsigned point_number_input,
+                  unsigned probe_number_input,
+                  double rank_tol_input)
+        : center(center_input),
+          radius(radius_input),
+          point_number(point_number_input),
+          probe_number(probe_number_input),
+          rank_tol(rank_tol_input),
+          eigen_solver(para_input, coeff_matrix_input, grid_info_input) {
+        if (!(radius > 0.) || point_number == 0 || probe_number == 0) {
+            throw std::invalid_argument(
+                "Contour needs positive radius, point number and probe "
+                "number.");
+        }
+        probe_number = std::min<unsigned>(probe_number, eigen_solver.dim);
+    }
+
+    /**
+     * @brief Eigenvalues inside the contour with unit 2-norm kernel vectors,
+     * sorted by distance to the center.
+     *
+     */
+    std::vector<EigenPair> solve() {
+        const std::size_t n = eigen_solver.dim;
+        const std::size_t l = probe_number;
+
+        // probe block, fixed seed to make runs reproducible
+        workspace_type<value_type> probe(n * l);
+        std::mt19937 gen(5489u);
+        std::normal_distribution<double> normal;
+        for (auto& v : probe) { v = {normal(gen), normal(gen)}; }
+
+        // K^-1 V of every point, added up in order afterwards so that the
+        // moments do not depend on which point finishes first
+        std::vector<workspace_type<value_type>> solutions(point_number);
+        std::atomic<unsigned> solved{};
+        auto solve_point = [&](EigenSolver<matrix_type>& solver, unsigned j) {
+            {
+                static const auto zone_id = Timer::intern("contour assembly");
+                Timer::Zone zone(zone_id);
+                solver.assembleAt(point(j));
+            }
+            auto x = probe;
+            {
+                static const auto zone_id = Timer::intern("linear solver");
+                Timer::Zone zone(zone_id);
+                solveInPlace(solver, x);
+            }
+            solutions[j] = std::move(x);
+            // one write per line, points finish on several threads
+            std::ostringstream oss;
+            oss << "        contour point " << ++solved << '/' << point_number
+                << ": " << point(j) << '\n';
+            std::cout << oss.str();
+        };
+
+        // Points are independent and run on the thread pool, each on a
+        // spare solver of its own. Kernel samples depend on the sign of
+        // Re(omega), so the points of one sign wait for eigen_solver to
+        // build them on the first point, and then share them.
+        for (const bool sign : {false, true}) {
+            std::vector<unsigned> points;
+            for (unsigned j = 0; j < point_number; ++j) {
+                if (std::signbit(point(j).real()) == sign) {
+                    points.push_back(j);
+                }
+            }
+            if (points.empty()) { continue; }
+            std::size_t first = 0;
+            if (eigen_solver.para.kernel_cache) {
+                solve_point(eigen_solver, points[first++]);
+            }
+            DedicatedThreadPool<void>::get_instance().parallel_for(
+                first, points.size(), std::size_t{1},
+                [&](std::size_t begin, std::size_t end) {
+                    auto solver = acquireSolver();
+                    for (auto k = begin; k < end; ++k) {
+                        solve_point(*solver, points[k]);
+                    }
+                    releaseSolver(std::move(solver));
+                });
+        }
+
+        // moments, column major n x l
+        workspace_type<value_type> moment_0(n * l);
+        workspace_type<value_type> moment_1(n * l);
+        for (unsigned j = 0; j < point_number; ++j) {
+            const auto z = unit_point(j);
+            // d omega / (2 pi i) = radius * z / N on trapezoid rule
+            const auto weight = radius * z / static_cast<double>(point_number);
+            const auto& x = solutions[j];
+            for (std::size_t i = 0; i < n * l; ++i) {
+                const auto wx = weight * x[i];
+                moment_0[i] += wx;
+                moment_1[i] += z * wx;
+            }
+        }
+
+        return extractEigenPairs(moment_0, moment_1);
+    }
+
+    // Numerical rank of A_0 found by last solve(), equal to probe number
+    // means some eigenvalues inside may be missed
+    std::size_t rank() const {
+        return rank_;
+    }
+
+    value_type center;
+    double radius;
+    unsigned point_number;
+    unsigned probe_number;
+    double rank_tol;
+
+   private:
+    EigenSolver<matrix_type> eigen_solver;
+    std::size_t rank_ = 0;
+    // one for each point solved at the same time, kept for the next solve
+    std::vector<std::unique_ptr<EigenSolver<matrix_type>>> spare_solvers;
+    std::mutex spare_mutex;
+
+    // z of point j on the unit circle, and omega of it
+    value_type unit_point(unsigned j) const {
+        return std::polar(1., 2. * std::numbers::pi * (j + .5) / point_number);
+    }
+    value_type point(unsigned j) const {
+        return center + radius * unit_point(j);
+    }
+
+    std::unique_ptr<EigenSolver<matrix_type>> acquireSolver() {
+        {
+            std::lock_guard lk(spare_mutex);
+            if (!spare_solvers.empty()) {
+                auto solver = std::move(spare_solvers.back());
+                spare_solvers.pop_back();
+                return solver;
+            }
+        }
+        auto solver = std::make_unique<EigenSolver<matrix_type>>(
+            eigen_solver.para, eigen_solver.coeff_matrix,
+            eigen_solver.grid_info);
+        solver->shareKernelSamples(eigen_solver);
+        return solver;
+    }
+    void releaseSolver(std::unique_ptr<EigenSolver<matrix_type>> solver) {
+        std::lock_guard lk(spare_mutex);
+        spare_solvers.push_back(std::move(solver));
+    }
+
+    // x <- K^-1 x, eigen matrix of solver is overwritten by its
+    // factorization
+    void solveInPlace(EigenSolver<matrix_type>& solver,
+                      workspace_type<value_type>& x) {
+        auto& mat = solver.eigen_matrix;
+        const char* upper = "Upper";
+        const lapack_int n = mat.getRows();
+        const lapack_int nrhs = probe_number;
+        workspace_type<lapack_int> ipiv(n);
+        lapack_int info{};
+
+        if constexpr (is_packed_symmetric_v<matrix_type>) {
+#ifdef EMME_MKL
+            zsptrf(upper, &n, mat.data(), ipiv.data(), &info);
+            if (info == 0) {
+                zsptrs(upper, &n, &nrhs, mat.data(), ipiv.data(), x.data(),
+                       &n, &info);
+            }
+#else
+            LAPACK_zsptrf(upper, &n, mat.data(), ipiv.data(), &info);
+            if (info == 0) {
+                LAPACK_zsptrs(upper, &n, &nrhs, mat.data(), ipiv.data(),
+                              x.data(), &n, &info);
+            }
+#endif
+        } else {
+            // eigen matrix is symmetric, its row major storage is what
+            // LAPACK expects
+            lapack_int lwork = -1;
+            workspace_type<value_type> work(1);
+            for (int pass = 0; pass < 2; ++pass) {
+#ifdef EMME_MKL
+                zsysv(upper, &n, &nrhs, mat.data(), &n, ipiv.data(),
+                      x.data(), &n, work.data(), &lwork, &info);
+#else
+                LAPACK_zsysv(upper, &n, &nrhs, mat.data(), &n, ipiv.data(),
+                             x.data(), &n, work.data(), &lwork, &info);
+#endif
+                lwork = std::max<lapack_int>(1, work[0].real());
+                work.resize(lwork);
+            }
+        }
+        if (info != 0) {
+            throw std::runtime_error(
+                "Eigen matrix is singular on the contour, try another "
+                "radius.");
+        }
+    }
+
+    std::vector<EigenPair> extractEigenPairs(
+        workspace_type<value_type>& moment_0,
+        const workspace_type<value_type>& moment_1) {
+        const lapack_int n = eigen_solver.dim;
+        const lapack_int l = probe_number;
+
+        // thin SVD of A_0, U is n x l and W^H is l x l
+        workspace_type<double> s(l);
+        workspace_type<value_type> u(n * l);
+        workspace_type<value_type> wh(l * l);
+        workspace_type<double> rwork(
+            std::max(5 * l * l + 5 * l, 2 * n * l + 2 * l * l + l));
+        workspace_type<lapack_int> iwork(8 * l);
+        lapack_int info{};
+        lapack_int lwork = -1;
+        workspace_type<value_type> work(1);
+        const char* jobz = "S";
+        for (int pass = 0; pass < 2; ++pass) {
+#ifdef EMME_MKL
+            zgesdd(jobz, &n, &l, moment_0.data(), &n, s.data(), u.data(), &n,
+                   wh.data(), &l, work.data(), &lwork, rwork.data(),
+                   iwork.data(), &info);
+#else
+            LAPACK_zgesdd(jobz, &n, &l, moment_0.data(), &n, s.data(),
+                          u.data(), &n, wh.data(), &l, work.data(), &lwork,
+                          rwork.data(), iwork.data(), &info);
+#endif
+            lwork = std::max<lapack_int>(1, work[0].real());
+            work.resize(lwork);
+        }
+        if (info != 0) {
+            throw std::runtime_error("SVD of contour moment failed.");
+        }
+
+        lapack_int k = 0;
+        while (k < l && s[k] > rank_tol * s[0]) { ++k; }
+        rank_ = k;
+        if (k == 0) { return {}; }
+        if (k == l) {
+            std::cerr << "        Contour moment has full rank " << k
+                      << ", increase contour_probe_number to make sure no "
+                         "eigenvalue is missed.\n";
+        }
+
+        // B = U_k^H A_1 W_k S_k^-1, column major k x k
+        workspace_type<value_type> a1w(n * k);
+        for (lapack_int q = 0; q < k; ++q) {
+            for (lapack_int p = 0; p < l; ++p) {
+                const auto w = std::conj(wh[q + p * l]);
+                for (lapack_int i = 0; i < n; ++i) {
+                    a1w[i + q * n] += moment_1[i + p * n] * w;
+                }
+            }
+        }
+        workspace_type<value_type> b(k * k);
+        for (lapack_int q = 0; q < k; ++q) {
+            for (lapack_int a = 0; a < k; ++a) {
+                value_type sum{};
+                for (lapack_int i = 0; i < n; ++i) {
+                    sum += std::conj(u[i + a * n]) * a1w[i + q * n];
+                }
+                b[a + q * k] = sum / s[q];
+            }
+        }
+
+        workspace_type<value_type> mu(k);
+        workspace_type<value_type> vr(k * k);
+        value_type vl_dummy{};
+        const lapack_int ldvl = 1;
+        workspace_type<double> rwork_geev(2 * k);
+        lwork = -1;
+        work.resize(1);
+        for (int pass = 0; pass < 2; ++pass) {
+#ifdef EMME_MKL
+            zgeev("N", "V", &k, b.data(), &k, mu.data(), &vl_dummy, &ldvl,
+                  vr.data(), &k, work.data(), &lwork, rwork_geev.data(),
+                  &info);
+#else
+            LAPACK_zgeev("N", "V", &k, b.data(), &k, mu.data(), &vl_dummy,
+                         &ldvl, vr.data(), &k, work.data(), &lwork,
+                         rwork_geev.data(), &info);
+#endif
+            lwork = std::max<lapack_int>(1, work[0].real());
+            work.resize(lwork);
+        }
+        if (info != 0) {
+            throw std::runtime_error("Eigen decomposition of contour moment "
+                                     "failed.");
+        }
+
+        std::vector<EigenPair> pairs;
+        for (lapack_int m = 0; m < k; ++m) {
+            // spurious ones from rank deficiency fall outside
+            if (std::abs(mu[m]) >= 1.) { continue; }
+            std::vector<value_type> x(n);
+            for (lapack_int a = 0; a < k; ++a) {
+                const auto c = vr[a + m * k];
+                for (lapack_int i = 0; i < n; ++i) { x[i] += u[i + a * n] * c; }
+            }
+            EigenSolver<matrix_type>::normalizeKernelVector(x);
+            pairs.push_back({center + radius * mu[m], std::move(x)});
+        }
+        std::sort(pairs.begin(), pairs.end(),
+                  [&](const auto& a, const auto& b) {
+                      return std::abs(a.eigen_value - center) <
+                             std::abs(b.eigen_value - center);
+                  });
+        return pairs;
+    }
+};
+
+#endif  // SOLVER_CONTOUR_H
@@ -11,7 +11,9 @@
 #include "Arithmetics.h"
 #include "DedicatedThreadPool.h"
 #include "Parameters.h"
+#include "ThreadPlacement.h"
 #include "Timer.h"
+#include "aligned-allocator.h"
 
 template <typename T>
 struct PIC_State {
@@ -46,13 +48,17 @@ struct PIC_State {
         }
     };
 
-    using marker_container_type = std::vector<Marker>;
-    using extra_container_type = std::vector<MarkerExtra>;
-    using field_type = std::vector<complex_type>;
+    // swept by every step, backed by huge pages
+    using marker_container_type =
+        util::huge_page_vector<Marker, MemoryAccount::pic_markers>;
+    using extra_container_type =
+        util::huge_page_vector<MarkerExtra, MemoryAccount::pic_markers>;
+    using field_type =
+        util::tagged_vector<complex_type, MemoryAccount::pic_field>;
 
     // wrapper class for expression template
     struct velocity_type : util::ExpressionTemplate {
-        std::vector<complex_type> data;
+        util::huge_page_vector<complex_type, MemoryAccount::pic_markers> data;
 
         velocity_type(std::size_t n) : data(n) {}
 
@@ -80,9 +86,9 @@ struct PIC_State {
     }
 
     void put_velocity(velocity_type& vs) const {
-        auto& thread_pool = DedicatedThreadPool<void>::get_instance();
-
         auto cal_velocity = [this, &vs](std::size_t begin, std::size_t end) {
+            static const auto zone_id = Timer::intern("velocity block");
+            Timer::Zone zone(zone_id);
             for (std::size_t i = begin; i < end; ++i) {
                 const auto& [eta, v_para, v_perp, weight] = markers[i];
 
@@ -124,35 +130,36 @@ struct PIC_State {
             }
         };
 
-        auto& timer = Timer::get_timer();
-        timer.start_timing("Particle Pushing");
-        constexpr std::size_t block_size = 512;
-        std::vector<std::future<void>> res;
-        for (std::size_t i = 0; i < marker_num() / block_size; ++i) {
-            res.push_back(thread_pool.queue_task([&, i]() {
-                cal_velocity(i * block_size, (i + 1) * block_size);
-            }));
-        }
-
-        cal_velocity(marker_num() / block_size * block_size, marker_num());
-        for (auto& f : res) { f.get(); }
-        timer.pause_timing("Particle Pushing");
+        static const auto zone_id = Timer::intern("Particle Pushing");
+        Timer::Zone zone(zone_id);
+        for_marker_blocks(cal_velocity);
     }
 
     template <typename U>
     void update(U&& velocity, value_type dt) {
-        auto& timer = Timer::get_timer();
-        timer.start_timing("Particle Pushing");
-        for (std::size_t i = 0; i < marker_num(); ++i) {
-            auto& eta = markers[i].eta;
-            eta = bound(eta + markers[i].v_para * dt / (para.q * para.R));
-            markers[i].weight += velocity[i] * dt;
+        {
+            static const auto zone_id = Timer::intern("Particle Pushing");
+            Timer::Zone zone(zone_id);
+            auto push = [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    auto& eta = markers[i].eta;
+                    eta = bound(eta +
+                                markers[i].v_para * dt / (para.q * para.R));
+                    markers[i].weight += velocity[i] * dt;
+                }
+            };
+            // a sweep too short to pay for splitting, unless its pages are
+            // spread over NUMA nodes
+            if (ThreadPlacement::pinned()) {
+                for_marker_blocks(push);
+            } else {
+                push(0, marker_num());
+            }
         }
-        timer.pause_timing("Particle Pushing");
 
-        timer.start_timing("Field Solve");
+        static const auto zone_id = Timer::intern("Field Solve");
+        Timer::Zone zone(zone_id);
         solve_field();
-        timer.pause_timing("Field Solve");
     }
 
     template <typename U>
@@ -177,6 +184,28 @@ struct PIC_State {
     const auto& current_field() const { return field; }
 
    private:
+    // markers a thread handles at least in one go
+    static constexpr std::size_t MARKER_GRAIN = 256;
+
+    // f(begin, end) over all markers. Once workers are pinned every worker
+    // takes its worker_block, the markers whose pages it touched first,
+    // otherwise the range is split on demand.
+    template <typename Func>
+    void for_marker_blocks(const Func& f) const {
+        auto& thread_pool = DedicatedThreadPool<void>::get_instance();
+        if (ThreadPlacement::pinned()) {
+            thread_pool.for_each_worker([&](std::size_t worker) {
+                const auto [begin, end] =
+                    thread_pool.worker_block(std::size_t{0}, marker_num(),
+                                             worker);
+                f(begin, end);
+            });
+        } else {
+            thread_pool.parallel_for(std::size_t{0}, marker_num(),
+                                     MARKER_GRAIN, f);
+        }
+    }
+
     auto initialize_marker(std::size_t n) {
         marker_container_type initial_markers;
         initial_markers.reserve(n);
@@ -247,19 +276,15 @@ struct PIC_State {
     }
 
     void solve_field() {
-        constexpr std::size_t batch_count = 1 << 8;
         auto& thread_pool = DedicatedThreadPool<void>::get_instance();
 
-        const auto nf = field.size();
-        // buffer
-        static std::vector<complex_type> buffer(batch_count * nf);
-
-        // calculate density
+        // add density of markers [begin, end) to density, an empty density
+        // being zero
         auto cal_density = [this](std::size_t begin, std::size_t end,
-                                  std::size_t buffer_begin) {
-            for (std::size_t i = 0; i < field.size(); ++i) {
-                buffer[buffer_begin + i] = 0;
-            }
+                                  field_type density) {
+            static const auto zone_id = Timer::intern("density block");
+            Timer::Zone zone(zone_id);
+            density.resize(field.size());
             for (std::size_t i = begin; i < end; ++i) {
                 const auto& [eta, v_para, v_perp, weight] = markers[i];
                 auto& [omega_dv, omega_st, p_weight, j0, dc_pb] =
@@ -279,78 +304,39 @@ struct PIC_State {
                 const auto [cell_idx, cell_w] = locate(eta);
 
                 // left grid point
-                buffer[buffer_begin + cell_idx] += den * (1. - cell_w);
-                buffer[buffer_begin + (cell_idx + 1) % field.size()] +=
-                    den * cell_w;
+                density[cell_idx] += den * (1. - cell_w);
+                density[(cell_idx + 1) % field.size()] += den * cell_w;
             }
+            return density;
+        };
+        auto add_density = [](field_type a, field_type b) {
+            if (a.size() < b.size()) { std::swap(a, b); }
+            for (std::size_t i = 0; i < b.size(); ++i) { a[i] += b[i]; }
+            return a;
         };
 
-        std::vector<std::future<void>> res;
-        const auto batch_size = marker_num() / batch_count;
-        const auto remain_size = marker_num() % batch_count;
-        for (std::size_t i = 0; i < batch_count; ++i) {
-            res.push_back(thread_pool.queue_task([&, i]() {
-                cal_density(
-                    i * batch_size + (i < remain_size ? i : remain_size),
-                    (i + 1) * batch_size +
-                        (i < remain_size ? i + 1 : remain_size),
-                    i * nf);
-            }));
-        }
-#if 0
-    constexpr std::size_t reduce_size =
-      4;  // batch_count should be a power of this number
-    // std::vector<std::future<void>> reduce_res;
-    // NOTE: Reservation is necessary here since I do not lock this vector
-    // when visiting it in other threads
-    res.reserve((batch_count * reduce_size - 1) / (reduce_size - 1));
-    for (std::size_t i = 0, current_level_idx = 0,
-	   current_level_task_count = batch_count / reduce_size;
-	 i < (batch_count - 1) / (reduce_size - 1);
-	 ++i, ++current_level_idx) {
-      if (current_level_idx == current_level_task_count) {
-	current_level_task_count /= reduce_size;
-	current_level_idx = 0;
-      }
-      res.push_back(thread_pool.queue_task([&, current_level_idx,
-					    current_level_task_count]() {
-	// wait for previous tasks
-	std::size_t last_level_begin =
-	  (batch_count - current_level_task_count * reduce_size) *
-	  reduce_size / (reduce_size - 1);
-	for (std::size_t j = 0; j < reduce_size; ++j) {
-	  res[last_level_begin + current_level_idx * reduce_size + j]
-	    .get();
-	}
-	std::size_t block_length =
-	  batch_count / current_level_task_count * nf;
-	for (std::size_t j = 1; j < reduce_size; ++j) {
-	  for (std::size_t k = 0; k < nf; ++k) {
-	    buffer[current_level_idx * block_length + k] +=
-	      buffer[current_level_idx * block_length +
-		     j * block_length / reduce_size + k];
-	  }
-	}
-      }));
-    }
-
-    res.back().get();
-    for (std::size_t idx = 0; idx < nf; ++idx) {
-      field[idx] = buffer[idx] * quasi_neutrality_coef[idx];
-    }
-#else
-        for (auto& f : res) { f.get(); }
-        for (std::size_t idx = 0; idx < nf; ++idx) { field[idx] = 0; }
-        for (std::size_t i = 0; i < batch_count; ++i) {
-            for (std::size_t idx = 0; idx < nf; ++idx) {
-                field[idx] += buffer[i * nf + idx];
+        field_type density;
+        if (ThreadPlacement::pinned()) {
+            // the blocks of for_marker_blocks, added up in worker order
+            std::vector<field_type> partial(thread_pool.thread_num());
+            thread_pool.for_each_worker([&](std::size_t worker) {
+                const auto [begin, end] = thread_pool.worker_block(
+                    std::size_t{0}, marker_num(), worker);
+                partial[worker] = cal_density(begin, end, field_type{});
+            });
+            for (auto& p : partial) {
+                density = add_density(std::move(density), std::move(p));
             }
+        } else {
+            density = thread_pool.parallel_reduce(
+                std::size_t{0}, marker_num(), MARKER_GRAIN, field_type{},
+                cal_density, add_density);
         }
-
-        for (std::size_t idx = 0; idx < nf; ++idx) {
-            field[idx] *= quasi_neutrality_coef[idx];
+        for (std::size_t idx = 0; idx < field.size(); ++idx) {
+            field[idx] = idx < density.size()
+                             ? density[idx] * quasi_neutrality_coef[idx]
+                             : 0;
         }
-#endif
     }
 
     static decltype(auto) random_gen() {
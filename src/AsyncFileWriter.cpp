@@ -0,0 +1,120 @@
+#include "AsyncFileWriter.h"
+
+#include <cstdio>
+#include <iostream>
+
+#ifdef EMME_ZLIB
+#include <zlib.h>
+#endif
+
+AsyncFileWriter::AsyncFileWriter(std::string file_name, bool compress_)
+    : name(std::move(file_name)), compress(compress_) {
+#ifndef EMME_ZLIB
+    if (compress) {
+        std::cerr << "Built without zlib, " << name
+                  << " is written uncompressed.\n";
+        compress = false;
+    }
+#endif
+    if (compress) { name += ".gz"; }
+    open();
+    writer = std::thread(&AsyncFileWriter::write_loop, this);
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    flush();
+    {
+        std::lock_guard lk(mutex);
+        should_terminate = true;
+    }
+    cv.notify_all();
+    writer.join();
+    close();
+}
+
+void AsyncFileWriter::truncate() {
+    filling.clear();
+    // writer thread is idle after flush
+    flush();
+    std::lock_guard lk(mutex);
+    close();
+    open();
+}
+
+void AsyncFileWriter::flush() {
+    if (!filling.empty()) { hand_over(); }
+    std::unique_lock lk(mutex);
+    cv.wait(lk, [this]() { return !has_writing; });
+}
+
+AsyncFileWriter::operator bool() const {
+    std::lock_guard lk(mutex);
+    return file && !failed;
+}
+
+void AsyncFileWriter::open() {
+#ifdef EMME_ZLIB
+    if (compress) {
+        // level 1, most of the gain at a fraction of the time
+        file = gzopen(name.c_str(), "wb1");
+        return;
+    }
+#endif
+    file = std::fopen(name.c_str(), "wb");
+}
+
+void AsyncFileWriter::close() {
+    if (!file) { return; }
+#ifdef EMME_ZLIB
+    if (compress) {
+        failed |= gzclose(static_cast<gzFile>(file)) != Z_OK;
+        file = nullptr;
+        return;
+    }
+#endif
+    failed |= std::fclose(static_cast<std::FILE*>(file)) != 0;
+    file = nullptr;
+}
+
+void AsyncFileWriter::hand_over() {
+    {
+        std::unique_lock lk(mutex);
+        cv.wait(lk, [this]() { return !has_writing; });
+        std::swap(filling, writing);
+        has_writing = true;
+    }
+    cv.notify_all();
+    filling.clear();
+}
+
+void AsyncFileWriter::write_loop() {
+    std::unique_lock lk(mutex);
+    while (true) {
+        cv.wait(lk, [this]() { return has_writing || should_terminate; });
+        if (!has_writing) { return; }
+
+        // the caller only touches the other buffer meanwhile
+        lk.unlock();
+        bool ok = true;
+        if (file) {
+#ifdef EMME_ZLIB
+            if (compress) {
+                ok = gzwrite(static_cast<gzFile>(file), writing.data(),
+                             writing.size()) ==
+                     static_cast<int>(writing.size());
+            } else
+#endif
+            {
+                ok = std::fwrite(writing.data(), 1, writing.size(),
+                                 static_cast<std::FILE*>(file)) ==
+                     writing.size();
+            }
+        }
+        lk.lock();
+
+        failed |= !ok;
+        writing.clear();
+        has_writing = false;
+        cv.notify_all();
+    }
+}
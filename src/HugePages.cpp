@@ -0,0 +1,221 @@
+#include "HugePages.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <fstream>
+#endif
+
+namespace {
+enum class Backing { plain, hugetlbfs, transparent };
+
+struct Block {
+    std::size_t length;
+    Backing backing;
+};
+
+// Blocks mapped on their own and their totals
+struct Registry {
+    std::mutex mutex;
+    std::unordered_map<void*, Block> blocks;
+    HugePages::usage total{};
+    std::size_t live_transparent{};
+};
+
+// Never destroyed, static containers may be freed after it otherwise
+Registry& registry() {
+    static auto& r = *new Registry;
+    return r;
+}
+
+std::size_t round_up(std::size_t size) {
+    return (size + HugePages::PAGE_BYTES - 1) / HugePages::PAGE_BYTES *
+           HugePages::PAGE_BYTES;
+}
+
+#ifdef __linux__
+// length bytes aligned to PAGE_BYTES, by mapping one page more and unmapping
+// what is around
+void* map_aligned(std::size_t length) {
+    const auto mapped_length = length + HugePages::PAGE_BYTES;
+    void* mapped = mmap(nullptr, mapped_length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) { return nullptr; }
+    const auto begin = reinterpret_cast<std::uintptr_t>(mapped);
+    const auto aligned = round_up(begin);
+    if (aligned != begin) { munmap(mapped, aligned - begin); }
+    if (const auto tail = begin + mapped_length - (aligned + length);
+        tail != 0) {
+        munmap(reinterpret_cast<void*>(aligned + length), tail);
+    }
+    return reinterpret_cast<void*>(aligned);
+}
+
+// AnonHugePages of the mappings holding ranges [begin, end). Adjacent blocks
+// with the same advice may be merged into one mapping, which is counted
+// once, at most the bytes of ranges inside it.
+std::size_t huge_bytes_in(
+    const std::vector<std::pair<std::uintptr_t, std::uintptr_t>>& ranges) {
+    std::ifstream smaps("/proc/self/smaps");
+    std::size_t result = 0;
+    std::size_t inside = 0;
+    std::string line;
+    while (std::getline(smaps, line)) {
+        unsigned long begin, end;
+        // a mapping starts with its address range, fields are "Name: value"
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &begin, &end) == 2) {
+            inside = 0;
+            for (const auto& [b, e] : ranges) {
+                const auto lo = std::max<std::uintptr_t>(b, begin);
+                const auto hi = std::min<std::uintptr_t>(e, end);
+                if (lo < hi) { inside += hi - lo; }
+            }
+        } else if (inside != 0 && line.starts_with("AnonHugePages:")) {
+            const auto kb = std::stoul(line.substr(line.find(':') + 1));
+            result += std::min<std::size_t>(kb * 1024, inside);
+        }
+    }
+    return result;
+}
+#endif
+}  // namespace
+
+void HugePages::set_policy(Policy policy) {
+    current_policy.store(policy, std::memory_order_relaxed);
+}
+
+void HugePages::set_first_touch(first_touch_function touch) {
+    touch_function.store(touch, std::memory_order_relaxed);
+}
+
+HugePages::Policy HugePages::parse_policy(std::string_view name) {
+    for (auto policy : {Policy::off, Policy::transparent, Policy::hugetlbfs}) {
+        if (name == HugePages::name(policy)) { return policy; }
+    }
+    throw std::invalid_argument("Huge page policy '" + std::string(name) +
+                                "' is not one of off, transparent and "
+                                "hugetlbfs.");
+}
+
+const char* HugePages::name(Policy policy) {
+    switch (policy) {
+        case Policy::off:
+            return "off";
+        case Policy::transparent:
+            return "transparent";
+        case Policy::hugetlbfs:
+            return "hugetlbfs";
+    }
+    return "";
+}
+
+void* HugePages::allocate(std::size_t size,
+                          [[maybe_unused]] bool first_touch) {
+#ifdef __linux__
+    if (size >= MIN_SIZE) {
+        const auto length = round_up(size);
+        const auto policy = HugePages::policy();
+        void* ptr = nullptr;
+        auto backing = Backing::plain;
+        if (policy == Policy::hugetlbfs) {
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr == MAP_FAILED) {
+                ptr = nullptr;
+            } else {
+                backing = Backing::hugetlbfs;
+            }
+        }
+        if (ptr == nullptr) {
+            ptr = map_aligned(length);
+            if (ptr == nullptr) { return nullptr; }
+            if (policy != Policy::off &&
+                madvise(ptr, length, MADV_HUGEPAGE) == 0) {
+                backing = Backing::transparent;
+            }
+        }
+        if (const auto touch =
+                first_touch ? touch_function.load(std::memory_order_relaxed)
+                            : nullptr) {
+            touch(ptr, length);
+        }
+
+        auto& r = registry();
+        std::lock_guard lk(r.mutex);
+        r.blocks.emplace(ptr, Block{length, backing});
+        r.total.mapped += length;
+        if (backing == Backing::hugetlbfs) { r.total.hugetlbfs += length; }
+        if (backing == Backing::transparent) {
+            r.total.transparent_advised += length;
+            r.live_transparent += length;
+        }
+        return ptr;
+    }
+#endif
+    void* ptr;
+    if (posix_memalign(&ptr, 64, size)) { ptr = nullptr; }
+    return ptr;
+}
+
+void HugePages::deallocate(void* ptr, std::size_t size) noexcept {
+#ifdef __linux__
+    if (size >= MIN_SIZE) {
+        auto& r = registry();
+        std::lock_guard lk(r.mutex);
+        const auto it = r.blocks.find(ptr);
+        if (it != r.blocks.end()) {
+            const auto [length, backing] = it->second;
+            if (backing == Backing::transparent) {
+                r.live_transparent -= length;
+            }
+            munmap(ptr, length);
+            r.blocks.erase(it);
+            return;
+        }
+    }
+#endif
+    free(ptr);
+}
+
+HugePages::usage HugePages::report() {
+    auto& r = registry();
+#ifdef __linux__
+    std::vector<std::pair<std::uintptr_t, std::uintptr_t>> ranges;
+    {
+        std::lock_guard lk(r.mutex);
+        if (r.live_transparent == 0) { return r.total; }
+        for (const auto& [ptr, block] : r.blocks) {
+            if (block.backing == Backing::transparent) {
+                const auto begin = reinterpret_cast<std::uintptr_t>(ptr);
+                ranges.emplace_back(begin, begin + block.length);
+            }
+        }
+    }
+    // not under the lock, so that allocations go on meanwhile
+    const auto backed = huge_bytes_in(ranges);
+    std::size_t sampled = 0;
+    for (const auto& [begin, end] : ranges) { sampled += end - begin; }
+
+    std::lock_guard lk(r.mutex);
+    if (backed > r.total.transparent_backed ||
+        r.total.transparent_sampled == 0) {
+        r.total.transparent_sampled = sampled;
+        r.total.transparent_backed = backed;
+    }
+    return r.total;
+#else
+    std::lock_guard lk(r.mutex);
+    return r.total;
+#endif
+}
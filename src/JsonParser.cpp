@@ -200,8 +200,9 @@ ValueCategory Value::value_category() const {
     return value_cat;
 }
 
-std::string Value::dump() const {
+std::string Value::dump(int precision) const {
     std::ostringstream oss;
+    oss.precision(precision);
     auto dump_typed_array =
         [&oss]<typename T>(const std::vector<T>& typed_array) {
             oss << '[';
@@ -232,7 +233,7 @@ std::string Value::dump() const {
         case ValueCategory::Object:
             oss << '{';
             for (const auto& [key, val] : as_object()) {
-                oss << '"' << key << '"' << ':' << val.dump() << ',';
+                oss << '"' << key << '"' << ':' << val.dump(precision) << ',';
             }
             if (!empty()) { oss.seekp(-1, std::ios_base::cur); }
             oss << '}';
@@ -241,7 +242,7 @@ std::string Value::dump() const {
             oss << '[';
             for (std::size_t i = 0; i < size(); ++i) {
                 if (i) { oss << ','; }
-                oss << operator[](i).dump();
+                oss << operator[](i).dump(precision);
             }
             oss << ']';
             break;
@@ -437,7 +438,7 @@ void JsonLexer::read_token_to_buffer() {
         buffer.col = col;
         do {
             buffer.content.push_back(c);
-            is_float |= c == '.';
+            is_float |= c == '.' || c == 'e' || c == 'E';
             ++col;
         } while (is_.get(c) && is_digit(c));
         buffer.name = is_float ? TokenName::FLOAT : TokenName::INTEGER;
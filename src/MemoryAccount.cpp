@@ -0,0 +1,61 @@
+#include "MemoryAccount.h"
+
+#include <algorithm>
+
+MemoryAccount::bytes MemoryAccount::current() {
+    bytes result;
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = counters[i].current.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+MemoryAccount::bytes MemoryAccount::peak() {
+    bytes result;
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        result[i] = counters[i].peak.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+const char* MemoryAccount::name(std::size_t tag) {
+    constexpr const char* names[TAG_NUMBER + 1] = {
+        "other",       "matrix",    "workspace", "kernels",
+        "pic_markers", "pic_field", "total"};
+    return names[tag];
+}
+
+void MemoryAccount::enable() {
+    windowing.store(true, std::memory_order_relaxed);
+}
+
+MemoryAccount::window_id MemoryAccount::open_window() {
+    auto open = open_windows.load(std::memory_order_relaxed);
+    window_id id;
+    do {
+        if (~open == 0) { return NO_WINDOW; }
+        id = static_cast<window_id>(std::countr_one(open));
+    } while (!open_windows.compare_exchange_weak(
+        open, open | (std::uint64_t{1} << id), std::memory_order_relaxed));
+
+    // Allocations between claiming and filling the window may be missed,
+    // they are in current() read here unless freed again.
+    for (std::size_t i = 0; i <= TAG_NUMBER; ++i) {
+        windows[id][i].store(
+            counters[i].current.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    }
+    return id;
+}
+
+MemoryAccount::bytes MemoryAccount::close_window(window_id id) {
+    bytes result;
+    for (std::size_t i = 0; i <= TAG_NUMBER; ++i) {
+        result[i] = std::max(
+            windows[id][i].load(std::memory_order_relaxed),
+            counters[i].current.load(std::memory_order_relaxed));
+    }
+    open_windows.fetch_and(~(std::uint64_t{1} << id),
+                           std::memory_order_relaxed);
+    return result;
+}
@@ -7,8 +7,10 @@
 using namespace std::literals;
 
 const Parameters& Parameters::generate(const util::json::Value& input) {
-    // Stellarator is the largest derived class
-    alignas(Stellarator) static std::byte buffer[sizeof(Stellarator)];
+    // Stellarator is the largest derived class, one per thread so that scan
+    // branches can run concurrently
+    alignas(Stellarator) static thread_local std::byte
+        buffer[sizeof(Stellarator)];
     auto para_ptr = reinterpret_cast<Parameters*>(buffer);
 
     // Parameters and Stellarator are both trivially
@@ -56,7 +58,15 @@ Parameters::Parameters(const util::json::Value& input)
       omega_s_e(-tau * omega_s_i),
       omega_d_bar(2.0 * epsilon_n * omega_s_i * omega_d_coeff),
       drift_center_transformation_switch(
-          input.at("drift_center_transformation_switch").as_boolean()) {}
+          input.at("drift_center_transformation_switch").as_boolean()),
+      kernel_cache(input.as_object().contains("kernel_cache") &&
+                   input.at("kernel_cache").as_boolean()),
+      analytic_derivative(input.as_object().contains("analytic_derivative") &&
+                          input.at("analytic_derivative").as_boolean()),
+      packed_storage(input.as_object().contains("packed_storage") &&
+                     input.at("packed_storage").as_boolean()),
+      mixed_precision(input.as_object().contains("mixed_precision") &&
+                      input.at("mixed_precision").as_boolean()) {}
 
 void Parameters::parameterInit() {
     alpha = q * q * R * beta_e / (epsilon_n * R) *
@@ -81,6 +91,21 @@ double Parameters::beta_1_e(double eta, double eta_p) const {
            (g_integration_f(eta) - g_integration_f(eta_p));
 }
 
+double Parameters::beta_1(const node_geometry& node,
+                          const node_geometry& node_p) const {
+    return (q * R) / vt * (omega_d_bar) * (node.g - node_p.g);
+}
+
+double Parameters::beta_1_e(const node_geometry& node,
+                            const node_geometry& node_p) const {
+    return (q * R) / vt * (omega_d_bar * omega_s_e / omega_s_i) *
+           (node.g - node_p.g);
+}
+
+Parameters::node_geometry Parameters::geometry(double eta) const {
+    return {.eta = eta, .bi = bi(eta), .g = g_integration_f(eta)};
+}
+
 double Parameters::bi(double eta) const {
     return b_theta * (1.0 + pow(shat * eta - alpha * std::sin(eta), 2));
 }
@@ -96,65 +121,168 @@ std::complex<double> Parameters::h_f_tau(std::complex<double> omega,
     return exp(std::complex<double>(0.0, 1.0) * tau * omega);
 }
 
-std::complex<double> Parameters::kappa_f_tau(unsigned int m,
-                                             double eta,
-                                             double eta_p,
-                                             std::complex<double> omega) const
-
-{
-    // Define the integrand function
-    auto integrand = [&](double taut_transformed) {
-        const auto omi = -std::copysign(1, omega.real());
-        const auto taut = arc_coeff * std::atan(taut_transformed) -
-                          1.i * omi * taut_transformed;
-        const auto jacob =
-            arc_coeff / (1 + taut_transformed * taut_transformed) - 1.i * omi;
-
-        std::complex<double> lambda_f_tau_term = lambda_f_tau(eta, eta_p, taut);
-        const auto bi_eta = bi(eta);
-        const auto bi_eta_p = bi(eta_p);
-
-        const auto [y0, y1, mu, z] = util::bessel_i_alter_helper(
-            std::sqrt(bi_eta * bi_eta_p) / lambda_f_tau_term);
-
-        const auto lambda_f_tau_term_cubic_inv =
-            std::pow(lambda_f_tau_term, -3.);
-        const auto norm_vel = (q * R * (eta - eta_p)) / (vt * taut);
-
-        const std::complex<double> i0_coef =
-            (omega -
-             omega_s_i * (1.0 + eta_i * (0.5 * norm_vel * norm_vel - 1.5))) /
-                lambda_f_tau_term +
-            omega_s_i * eta_i * (.5 * (bi_eta + bi_eta_p) - lambda_f_tau_term) *
-                lambda_f_tau_term_cubic_inv;
+template <std::size_t N>
+std::array<Parameters::KernelSample, N> Parameters::kernel_sample_batch(
+    const node_geometry& node,
+    const node_geometry& node_p,
+    double omi,
+    const std::array<double, N>& taut_transformed) const {
+    // Arithmetic below is done on util::detail::plain_complex, in loops over
+    // nodes without branches, so that they vectorize. Only atan and the Bessel
+    // recurrence (which is batched itself) are left out of these loops.
+    using cplx = util::detail::plain_complex;
+
+    // independent of quadrature nodes
+    const auto bi_eta = node.bi;
+    const auto bi_eta_p = node_p.bi;
+    const auto sqrt_bi = std::sqrt(bi_eta * bi_eta_p);
+    const auto beta_1_val = beta_1(node, node_p);
+    // lambda_f_tau = 1 + i * lambda_coef * taut
+    const auto lambda_coef =
+        0.5 * vt / (q * R * (node.eta - node_p.eta)) * beta_1_val;
+    // norm_vel = norm_vel_coef / taut
+    const auto norm_vel_coef = (q * R * (node.eta - node_p.eta)) / vt;
+
+    std::array<double, N> taut_re;
+    for (std::size_t k = 0; k < N; ++k) {
+        taut_re[k] = arc_coeff * std::atan(taut_transformed[k]);
+    }
 
-        const std::complex<double> i1_coef = -omega_s_i * eta_i *
-                                             std::sqrt(bi_eta * bi_eta_p) *
-                                             lambda_f_tau_term_cubic_inv;
+    std::array<cplx, N> lambda_inv;
+    std::array<std::complex<double>, N> bessel_arg;
+    for (std::size_t k = 0; k < N; ++k) {
+        const cplx taut{taut_re[k], -omi * taut_transformed[k]};
+        lambda_inv[k] = inverse(cplx{1. - lambda_coef * taut.im,
+                                     lambda_coef * taut.re});
+        bessel_arg[k] = sqrt_bi * lambda_inv[k];
+    }
 
-        const auto beta_1_val = beta_1(eta, eta_p);
+    const auto [y0, y1, mu, z] = util::bessel_i_alter_batch(bessel_arg);
+
+    std::array<KernelSample, N> samples;
+    for (std::size_t k = 0; k < N; ++k) {
+        const double t = taut_transformed[k];
+        const cplx taut{taut_re[k], -omi * t};
+        const cplx jacob{arc_coeff / (1 + t * t), -omi};
+        const cplx taut_inv = inverse(taut);
+        const cplx norm_vel = norm_vel_coef * taut_inv;
+        const cplx norm_vel_sq = norm_vel * norm_vel;
+        const cplx lambda_f_tau_term = inverse(lambda_inv[k]);
+        const cplx lambda_f_tau_term_cubic_inv =
+            lambda_inv[k] * lambda_inv[k] * lambda_inv[k];
+
+        // i0_coef = omega / lambda_f_tau_term + i0_coef_0
+        const cplx i0_coef_0 =
+            (-omega_s_i) * (cplx{1.0} + eta_i * (0.5 * norm_vel_sq - 1.5)) *
+                lambda_inv[k] +
+            (omega_s_i * eta_i) *
+                (cplx{.5 * (bi_eta + bi_eta_p)} - lambda_f_tau_term) *
+                lambda_f_tau_term_cubic_inv;
+        const cplx i1_coef =
+            (-omega_s_i * eta_i * sqrt_bi) * lambda_f_tau_term_cubic_inv;
 
         // logarithmic of normalized parallel velocity in exponential term,
         // following terms is similar
-        const auto log_norm_vel = -0.5 * norm_vel * norm_vel;
-        const auto log_i_beta = -.5i * beta_1_val * norm_vel;
-        const auto log_hf_tau = 1.i * taut * omega;
-        const auto log_exp_term_int_lambda_tau =
-            -(bi_eta + bi_eta_p) / (2.0 + 1.i * beta_1_val / norm_vel);
-
-        const auto log_coef = log_norm_vel + log_i_beta + log_hf_tau +
-                              log_exp_term_int_lambda_tau;
-
-        // deal with underflow problem
-        const auto safe_exp = [](auto var) {
-            if (std::real(var) < -40.) {
-                return std::complex<double>{0.};
-            } else {
-                return std::exp(var);
-            }
-        };
-        return std::pow(norm_vel, m) / taut * jacob * safe_exp(log_coef - z) *
-               (i0_coef * y0 + i1_coef * y1) / mu;
+        const cplx log_norm_vel = -0.5 * norm_vel_sq;
+        const cplx log_i_beta{.5 * beta_1_val * norm_vel.im,
+                              -.5 * beta_1_val * norm_vel.re};
+        // i * beta_1_val / norm_vel = i * beta_1_val * taut / norm_vel_coef
+        const cplx log_exp_term_int_lambda_tau =
+            -(bi_eta + bi_eta_p) *
+            inverse(cplx{2.0 - beta_1_val / norm_vel_coef * taut.im,
+                         beta_1_val / norm_vel_coef * taut.re});
+
+        const cplx prefactor = taut_inv * jacob * inverse(cplx{mu[k]});
+        samples[k] = {
+            .taut = taut,
+            .norm_vel = norm_vel,
+            .log_coef = log_norm_vel + log_i_beta +
+                        log_exp_term_int_lambda_tau - cplx{z[k]},
+            .c0 = prefactor * (i0_coef_0 * cplx{y0[k]} + i1_coef * cplx{y1[k]}),
+            .c1 = prefactor * cplx{y0[k]} * lambda_inv[k]};
+    }
+    return samples;
+}
+
+Parameters::KernelSample Parameters::kernel_sample(const node_geometry& node,
+                                                  const node_geometry& node_p,
+                                                  double omi,
+                                                  double taut_transformed,
+                                                  double weight) const {
+    auto sample =
+        kernel_sample_batch<1>(node, node_p, omi, {taut_transformed})[0];
+    sample.c0 *= weight;
+    sample.c1 *= weight;
+    return sample;
+}
+
+std::complex<double> Parameters::KernelSample::operator()(
+    unsigned int m,
+    std::complex<double> omega) const {
+    const auto log_hf_tau = 1.i * taut * omega;
+    // deal with underflow problem
+    if (std::real(log_coef + log_hf_tau) < -40.) { return 0.; }
+
+    std::complex<double> norm_vel_pow = 1.;
+    for (unsigned int k = 0; k < m; ++k) { norm_vel_pow *= norm_vel; }
+    return norm_vel_pow * std::exp(log_coef + log_hf_tau) * (omega * c1 + c0);
+}
+
+Parameters::kappa_moments_type Parameters::KernelSample::moments(
+    std::complex<double> omega) const {
+    const auto log_hf_tau = 1.i * taut * omega;
+    // deal with underflow problem
+    if (std::real(log_coef + log_hf_tau) < -40.) { return {}; }
+
+    const auto m0 = std::exp(log_coef + log_hf_tau) * (omega * c1 + c0);
+    return {{m0, m0 * norm_vel, m0 * norm_vel * norm_vel}};
+}
+
+Parameters::kappa_derivative_type Parameters::KernelSample::with_derivative(
+    unsigned int m,
+    std::complex<double> omega) const {
+    const auto log_hf_tau = 1.i * taut * omega;
+    // deal with underflow problem
+    if (std::real(log_coef + log_hf_tau) < -40.) { return {}; }
+
+    std::complex<double> norm_vel_pow = 1.;
+    for (unsigned int k = 0; k < m; ++k) { norm_vel_pow *= norm_vel; }
+    const auto exp_term = norm_vel_pow * std::exp(log_coef + log_hf_tau);
+    const auto value = exp_term * (omega * c1 + c0);
+    return {{value, 1.i * taut * value + exp_term * c1}};
+}
+
+Parameters::kappa_moments_derivative_type
+Parameters::KernelSample::moments_with_derivative(
+    std::complex<double> omega) const {
+    const auto log_hf_tau = 1.i * taut * omega;
+    // deal with underflow problem
+    if (std::real(log_coef + log_hf_tau) < -40.) { return {}; }
+
+    const auto exp_term = std::exp(log_coef + log_hf_tau);
+    const auto m0 = exp_term * (omega * c1 + c0);
+    const auto d0 = 1.i * taut * m0 + exp_term * c1;
+    const auto norm_vel_sq = norm_vel * norm_vel;
+    return {{m0, m0 * norm_vel, m0 * norm_vel_sq, d0, d0 * norm_vel,
+             d0 * norm_vel_sq}};
+}
+
+template <typename SampleFunc>
+auto Parameters::integrate_kernel(const node_geometry& node,
+                                  const node_geometry& node_p,
+                                  std::complex<double> omega,
+                                  SampleFunc&& sample_func) const {
+    const auto omi = -std::copysign(1, omega.real());
+    // Define the integrand function, evaluated on all nodes of a panel at once
+    auto integrand = [&]<std::size_t N>(
+                         const std::array<double, N>& taut_transformed) {
+        const auto samples =
+            kernel_sample_batch(node, node_p, omi, taut_transformed);
+        std::array<decltype(sample_func(samples[0])), N> values;
+        for (std::size_t k = 0; k < N; ++k) {
+            values[k] = sample_func(samples[k]);
+        }
+        return values;
     };
 
     auto result =
@@ -165,12 +293,141 @@ std::complex<double> Parameters::kappa_f_tau(unsigned int m,
            (vt * std::sqrt((2.0 * M_PI))) * result;
 }
 
+template <typename SampleFunc>
+auto Parameters::sum_kernel(const kernel_samples_type& samples,
+                            SampleFunc&& sample_func) const {
+    decltype(sample_func(samples[0])) result{};
+    for (const auto& sample : samples) { result += sample_func(sample); }
+
+    return -std::complex<double>(0, 1.0) * (q * R) /
+           (vt * std::sqrt((2.0 * M_PI))) * result;
+}
+
+std::complex<double> Parameters::kappa_f_tau(unsigned int m,
+                                             double eta,
+                                             double eta_p,
+                                             std::complex<double> omega) const {
+    return kappa_f_tau(m, geometry(eta), geometry(eta_p), omega);
+}
+
+std::complex<double> Parameters::kappa_f_tau(unsigned int m,
+                                             const node_geometry& node,
+                                             const node_geometry& node_p,
+                                             std::complex<double> omega) const {
+    return integrate_kernel(node, node_p, omega, [&](const auto& sample) {
+        return sample(m, omega);
+    });
+}
+
+std::complex<double> Parameters::kappa_f_tau(
+    unsigned int m,
+    const kernel_samples_type& samples,
+    std::complex<double> omega) const {
+    return sum_kernel(samples,
+                      [&](const auto& sample) { return sample(m, omega); });
+}
+
+Parameters::kappa_moments_type Parameters::kappa_f_tau_moments(
+    const node_geometry& node,
+    const node_geometry& node_p,
+    std::complex<double> omega) const {
+    return integrate_kernel(node, node_p, omega, [&](const auto& sample) {
+        return sample.moments(omega);
+    });
+}
+
+Parameters::kappa_moments_type Parameters::kappa_f_tau_moments(
+    const kernel_samples_type& samples,
+    std::complex<double> omega) const {
+    return sum_kernel(samples, [&](const auto& sample) {
+        return sample.moments(omega);
+    });
+}
+
+Parameters::kappa_derivative_type Parameters::kappa_f_tau_with_derivative(
+    unsigned int m,
+    const node_geometry& node,
+    const node_geometry& node_p,
+    std::complex<double> omega) const {
+    return integrate_kernel(node, node_p, omega, [&](const auto& sample) {
+        return sample.with_derivative(m, omega);
+    });
+}
+
+Parameters::kappa_derivative_type Parameters::kappa_f_tau_with_derivative(
+    unsigned int m,
+    const kernel_samples_type& samples,
+    std::complex<double> omega) const {
+    return sum_kernel(samples, [&](const auto& sample) {
+        return sample.with_derivative(m, omega);
+    });
+}
+
+Parameters::kappa_moments_derivative_type
+Parameters::kappa_f_tau_moments_with_derivative(
+    const node_geometry& node,
+    const node_geometry& node_p,
+    std::complex<double> omega) const {
+    return integrate_kernel(node, node_p, omega, [&](const auto& sample) {
+        return sample.moments_with_derivative(omega);
+    });
+}
+
+Parameters::kappa_moments_derivative_type
+Parameters::kappa_f_tau_moments_with_derivative(
+    const kernel_samples_type& samples,
+    std::complex<double> omega) const {
+    return sum_kernel(samples, [&](const auto& sample) {
+        return sample.moments_with_derivative(omega);
+    });
+}
+
+Parameters::kernel_samples_type Parameters::kappa_f_tau_samples(
+    const node_geometry& node,
+    const node_geometry& node_p,
+    std::complex<double> omega) const {
+    const auto omi = -std::copysign(1, omega.real());
+    // the subdivision is the one adaptive integration would choose at omega
+    auto build_rule = [&](auto&& integrand) {
+        return util::integration_rule(
+            integrand, integration_precision, integration_accuracy,
+            integration_iteration_limit, integration_start_points);
+    };
+    auto rule =
+        std::fpclassify(beta_e) == FP_ZERO
+            ? build_rule([&](double taut_transformed) {
+                  return kernel_sample(node, node_p, omi, taut_transformed)(
+                      0, omega);
+              })
+            : build_rule([&](double taut_transformed) {
+                  return kernel_sample(node, node_p, omi, taut_transformed)
+                      .moments(omega);
+              });
+
+    kernel_samples_type samples;
+    samples.reserve(rule.size());
+    for (const auto& [x, w] : rule) {
+        samples.push_back(kernel_sample(node, node_p, omi, x, w));
+    }
+    return samples;
+}
+
+std::complex<double> Parameters::kappa_f_tau_e(
+    unsigned int m,
+    double eta,
+    double eta_p,
+    std::complex<double> omega) const {
+    return kappa_f_tau_e(m, geometry(eta), geometry(eta_p), omega);
+}
+
 std::complex<double> Parameters::kappa_f_tau_e(unsigned int m,
-                                               double eta,
-                                               double eta_p,
+                                               const node_geometry& node,
+                                               const node_geometry& node_p,
                                                std::complex<double> omega) const
 
 {
+    const auto eta = node.eta;
+    const auto eta_p = node_p.eta;
     switch (m) {
         case 0:
             return 0.0;
@@ -182,7 +439,7 @@ std::complex<double> Parameters::kappa_f_tau_e(unsigned int m,
             return (q * q * R * R) / (2.0 * vt * vt * tau) * (eta - eta_p) /
                    (std::abs(eta - eta_p)) *
                    (omega * (omega - omega_s_e) * (eta - eta_p) -
-                    beta_1_e(eta, eta_p) * vt / (q * R) *
+                    beta_1_e(node, node_p) * vt / (q * R) *
                         (omega - omega_s_e * (1.0 + eta_e)));
         default:
             // Handle unexpected mode (throw exception or return special value)
@@ -190,6 +447,30 @@ std::complex<double> Parameters::kappa_f_tau_e(unsigned int m,
     }
 }
 
+std::complex<double> Parameters::kappa_f_tau_e_derivative(
+    unsigned int m,
+    const node_geometry& node,
+    const node_geometry& node_p,
+    std::complex<double> omega) const {
+    const auto eta = node.eta;
+    const auto eta_p = node_p.eta;
+    switch (m) {
+        case 0:
+            return 0.0;
+        case 1:
+            return -std::complex<double>(0.0, 1.0) * (q * R) /
+                   (2.0 * vt * tau) * (eta - eta_p) / (std::abs(eta - eta_p));
+        case 2:
+            return (q * q * R * R) / (2.0 * vt * vt * tau) * (eta - eta_p) /
+                   (std::abs(eta - eta_p)) *
+                   ((2.0 * omega - omega_s_e) * (eta - eta_p) -
+                    beta_1_e(node, node_p) * vt / (q * R));
+        default:
+            // Handle unexpected mode (throw exception or return special value)
+            throw std::invalid_argument("Unsupported mode value");
+    }
+}
+
 Stellarator::Stellarator(const util::json::Value& input)
     : Parameters(input),
       eta_k(input.at("eta_k")),
@@ -0,0 +1,158 @@
+#include "PerfCounters.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace {
+std::array<bool, PerfCounters::COUNTER_NUMBER> opened{};
+
+#ifdef __linux__
+struct event_config {
+    std::uint32_t type;
+    std::uint64_t config;
+};
+
+constexpr std::array<event_config, PerfCounters::COUNTER_NUMBER> EVENTS{{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    // last level cache on most cores
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    // FP_ARITH_INST_RETIRED (0xc7), umask of all packed widths
+    {PERF_TYPE_RAW, 0xfcc7},
+}};
+
+// The raw event number only means FP_ARITH_INST_RETIRED on Intel
+bool is_intel() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    // "GenuineIntel" in ebx, edx, ecx
+    return __get_cpuid(0, &eax, &ebx, &ecx, &edx) && ebx == 0x756e6547 &&
+           edx == 0x49656e69 && ecx == 0x6c65746e;
+#else
+    return false;
+#endif
+}
+
+struct thread_counters {
+    int leader = -1;
+    // first error of perf_event_open
+    int error = 0;
+    std::size_t number = 0;
+    std::array<int, PerfCounters::COUNTER_NUMBER> fds;
+    // index in the group read, -1 if not opened
+    std::array<int, PerfCounters::COUNTER_NUMBER> position;
+
+    thread_counters() {
+        fds.fill(-1);
+        position.fill(-1);
+        for (std::size_t i = 0; i < EVENTS.size(); ++i) {
+            if (i == PerfCounters::fp_vector && !is_intel()) { continue; }
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = EVENTS[i].type;
+            attr.config = EVENTS[i].config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            // this thread on any cpu
+            const int fd = static_cast<int>(
+                syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                if (error == 0) { error = errno; }
+                continue;
+            }
+            if (leader < 0) { leader = fd; }
+            fds[i] = fd;
+            position[i] = static_cast<int>(number++);
+        }
+    }
+    ~thread_counters() {
+        for (auto fd : fds) {
+            if (fd >= 0) { close(fd); }
+        }
+    }
+    thread_counters(const thread_counters&) = delete;
+    thread_counters& operator=(const thread_counters&) = delete;
+};
+
+thread_counters& local_counters() {
+    static thread_local thread_counters counters;
+    return counters;
+}
+#endif
+}  // namespace
+
+bool PerfCounters::enable() {
+#ifdef __linux__
+    const auto& counters = local_counters();
+    if (counters.leader < 0) {
+        std::cerr << "Can not open hardware performance counters: "
+                  << std::strerror(counters.error)
+                  << ". See /proc/sys/kernel/perf_event_paranoid, virtual "
+                     "machines may have no counter at all.\n";
+        return false;
+    }
+    for (std::size_t i = 0; i < COUNTER_NUMBER; ++i) {
+        opened[i] = counters.position[i] >= 0;
+    }
+    counting.store(true, std::memory_order_release);
+    return true;
+#else
+    std::cerr << "Hardware performance counters are only read on Linux.\n";
+    return false;
+#endif
+}
+
+bool PerfCounters::available(Counter counter) {
+    return enabled() && opened[counter];
+}
+
+const char* PerfCounters::name(Counter counter) {
+    constexpr const char* names[COUNTER_NUMBER] = {
+        "cycles", "instructions", "llc_misses", "branch_misses", "fp_vector"};
+    return names[counter];
+}
+
+PerfCounters::values PerfCounters::read() {
+    values result{};
+#ifdef __linux__
+    if (!enabled()) { return result; }
+    const auto& counters = local_counters();
+    if (counters.leader < 0) { return result; }
+
+    // number, time enabled, time running, values
+    std::uint64_t buffer[3 + COUNTER_NUMBER];
+    const auto size = (3 + counters.number) * sizeof(std::uint64_t);
+    if (::read(counters.leader, buffer, size) !=
+        static_cast<ssize_t>(size)) {
+        return result;
+    }
+    const auto time_enabled = buffer[1];
+    const auto time_running = buffer[2];
+    for (std::size_t i = 0; i < COUNTER_NUMBER; ++i) {
+        if (counters.position[i] < 0) { continue; }
+        const auto value = buffer[3 + counters.position[i]];
+        result[i] = time_running != 0 && time_running < time_enabled
+                        ? static_cast<std::uint64_t>(
+                              static_cast<double>(value) * time_enabled /
+                              time_running)
+                        : value;
+    }
+#endif
+    return result;
+}
@@ -0,0 +1,237 @@
+#include "RecordContainer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(std::endian::native == std::endian::little,
+              "Record container is written in little endian.");
+
+namespace {
+constexpr char FILE_MAGIC[8] = {'E', 'M', 'M', 'E', 'D', 'U', 'M', 'P'};
+constexpr char INDEX_MAGIC[8] = {'E', 'M', 'M', 'E', 'I', 'N', 'D', 'X'};
+constexpr char RECORD_MAGIC[8] = {'E', 'M', 'M', 'E', 'R', 'E', 'C', '\0'};
+constexpr char DISCARD_MAGIC[8] = {'E', 'M', 'M', 'E', 'D', 'S', 'C', '\0'};
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t record_header_size;
+    std::uint64_t alignment;
+    char reserved[40];
+};
+static_assert(sizeof(FileHeader) == 64);
+
+struct Trailer {
+    char magic[8];
+    std::uint64_t index_offset;
+    std::uint64_t record_number;
+    char reserved[40];
+};
+static_assert(sizeof(Trailer) == 64);
+
+struct DiscardMark {
+    char magic[8];
+    std::uint64_t record;
+    char reserved[48];
+};
+static_assert(sizeof(DiscardMark) == RecordContainer::ALIGNMENT);
+
+std::uint64_t align(std::uint64_t offset) {
+    const auto a = RecordContainer::ALIGNMENT;
+    return (offset + a - 1) / a * a;
+}
+}  // namespace
+
+RecordContainer::RecordContainer(std::string file_name)
+    : file(std::move(file_name)) {
+    FileHeader header{};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = VERSION;
+    header.record_header_size = sizeof(RecordHeader);
+    header.alignment = ALIGNMENT;
+    file.write(&header, 1);
+    size = sizeof(header);
+}
+
+RecordContainer::~RecordContainer() {
+    std::lock_guard lk(mutex);
+    pad();
+    Trailer trailer{};
+    std::memcpy(trailer.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    trailer.index_offset = size;
+    trailer.record_number = index.size();
+    file.write(index.data(), index.size());
+    file.write(&trailer, 1);
+}
+
+RecordContainer::RecordWriter RecordContainer::begin_record(
+    RecordHeader header) {
+    std::memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    header.flags = 0;
+
+    std::unique_lock lk(mutex);
+    pad();
+    header.data_offset = size + sizeof(RecordHeader);
+    file.write(&header, 1);
+    size = header.data_offset + header.data_size;
+    index.push_back(header);
+    return RecordWriter(*this, std::move(lk), index.size() - 1,
+                        header.data_size);
+}
+
+std::size_t RecordContainer::append(RecordHeader header, const void* data) {
+    auto record = begin_record(header);
+    record.write(data, header.data_size);
+    return record.finish();
+}
+
+void RecordContainer::discard(std::size_t idx) {
+    std::lock_guard lk(mutex);
+    mark_discarded(idx);
+}
+
+void RecordContainer::flush() {
+    std::lock_guard lk(mutex);
+    file.flush();
+}
+
+void RecordContainer::mark_discarded(std::size_t idx) {
+    index.at(idx).flags |= DISCARDED;
+    // so that a crashed run does not bring the record back
+    pad();
+    DiscardMark mark{};
+    std::memcpy(mark.magic, DISCARD_MAGIC, sizeof(DISCARD_MAGIC));
+    mark.record = idx;
+    file.write(&mark, 1);
+    size += sizeof(mark);
+}
+
+RecordContainer::RecordWriter::RecordWriter(RecordContainer& container_,
+                                            std::unique_lock<std::mutex> lock_,
+                                            std::size_t idx_,
+                                            std::uint64_t remaining_)
+    : container(&container_),
+      lock(std::move(lock_)),
+      idx(idx_),
+      remaining(remaining_) {}
+
+RecordContainer::RecordWriter::~RecordWriter() {
+    if (!lock.owns_lock()) { return; }
+    static constexpr char zeros[ALIGNMENT]{};
+    while (remaining != 0) {
+        const auto chunk = std::min<std::uint64_t>(remaining, sizeof(zeros));
+        container->file.write(zeros, chunk);
+        remaining -= chunk;
+    }
+    container->mark_discarded(idx);
+}
+
+void RecordContainer::RecordWriter::write(const void* data,
+                                          std::size_t bytes) {
+    if (bytes > remaining) {
+        throw std::logic_error("Record data is larger than its header says.");
+    }
+    container->file.write(static_cast<const char*>(data), bytes);
+    remaining -= bytes;
+}
+
+std::size_t RecordContainer::RecordWriter::finish() {
+    if (remaining != 0) {
+        throw std::logic_error("Record data is smaller than its header says.");
+    }
+    lock.unlock();
+    return idx;
+}
+
+void RecordContainer::pad() {
+    static constexpr char zeros[ALIGNMENT]{};
+    const auto aligned = align(size);
+    file.write(zeros, aligned - size);
+    size = aligned;
+}
+
+RecordContainerView::RecordContainerView(const std::string& file_name) {
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Can not open '" + file_name + "'.");
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 ||
+        static_cast<std::size_t>(st.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("'" + file_name +
+                                 "' is not a record container.");
+    }
+    length = st.st_size;
+    void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Can not map '" + file_name + "'.");
+    }
+    base = static_cast<const char*>(mapped);
+
+    FileHeader file_header;
+    std::memcpy(&file_header, base, sizeof(file_header));
+    if (std::memcmp(file_header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        file_header.version != RecordContainer::VERSION ||
+        file_header.record_header_size != sizeof(RecordHeader)) {
+        ::munmap(const_cast<char*>(base), length);
+        throw std::runtime_error("'" + file_name +
+                                 "' is not a record container of version " +
+                                 std::to_string(RecordContainer::VERSION) +
+                                 ".");
+    }
+
+    Trailer trailer{};
+    if (length >= sizeof(FileHeader) + sizeof(Trailer)) {
+        std::memcpy(&trailer, base + length - sizeof(Trailer),
+                    sizeof(trailer));
+    }
+    if (std::memcmp(trailer.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+        trailer.index_offset +
+                trailer.record_number * sizeof(RecordHeader) +
+                sizeof(Trailer) ==
+            length) {
+        headers.resize(trailer.record_number);
+        std::memcpy(headers.data(), base + trailer.index_offset,
+                    headers.size() * sizeof(RecordHeader));
+        return;
+    }
+
+    // no index, take every complete record and apply the discard marks
+    recovered_ = true;
+    std::uint64_t offset = align(sizeof(FileHeader));
+    while (offset + sizeof(DiscardMark) <= length) {
+        DiscardMark mark;
+        std::memcpy(&mark, base + offset, sizeof(mark));
+        if (std::memcmp(mark.magic, DISCARD_MAGIC, sizeof(DISCARD_MAGIC)) ==
+            0) {
+            if (mark.record >= headers.size()) { break; }
+            headers[mark.record].flags |= RecordContainer::DISCARDED;
+            offset += sizeof(mark);
+            continue;
+        }
+        if (offset + sizeof(RecordHeader) > length) { break; }
+        RecordHeader header;
+        std::memcpy(&header, base + offset, sizeof(header));
+        if (std::memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) !=
+                0 ||
+            header.data_offset != offset + sizeof(RecordHeader) ||
+            header.data_offset + header.data_size > length) {
+            break;
+        }
+        headers.push_back(header);
+        offset = align(header.data_offset + header.data_size);
+    }
+}
+
+RecordContainerView::~RecordContainerView() {
+    ::munmap(const_cast<char*>(base), length);
+}
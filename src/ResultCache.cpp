@@ -0,0 +1,165 @@
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace {
+// format version of cache file
+constexpr char MAGIC[] = "EMME result cache 2\n";
+
+// input keys that only control how a scan runs or how output looks
+bool is_ignored_key(const std::string& key) {
+    return key.starts_with("_comment") || key == "initial_guess" ||
+           key == "scan_continuation" || key == "scan_concurrency" ||
+           key == "scan_grid" || key == "result_cache" ||
+           key == "output_stream" || key == "output_stream_sync" ||
+           key == "profile_trace" || key == "perf_counters" ||
+           key == "memory_report" || key == "huge_pages" ||
+           key == "thread_placement" || key == "thread_cores" ||
+           key.starts_with("eigen_matrix_");
+}
+
+// 64-bit FNV-1a
+std::uint64_t hash(const std::string& str) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : str) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+template <typename T>
+void write_pod(std::ostream& os, const T& val) {
+    os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template <typename T>
+bool read_pod(std::istream& is, T& val) {
+    return static_cast<bool>(
+        is.read(reinterpret_cast<char*>(&val), sizeof(T)));
+}
+}  // namespace
+
+ResultCache::ResultCache(std::filesystem::path directory_,
+                         std::string build_hash_)
+    : directory(std::move(directory_)), build_hash(std::move(build_hash_)) {
+    std::filesystem::create_directories(directory);
+}
+
+std::string ResultCache::key(const util::json::Value& input,
+                             std::complex<double> initial_guess) const {
+    std::ostringstream oss;
+    oss << std::setprecision(17) << "build:" << build_hash << "\ninput:";
+    canonical(oss, input, true);
+    oss << "\ninitial_guess:" << initial_guess.real() << ','
+        << initial_guess.imag();
+    return oss.str();
+}
+
+std::optional<ResultCache::Entry> ResultCache::load(
+    const std::string& key) const {
+    std::ifstream file(file_path(key), std::ios::binary);
+    if (!file) { return {}; }
+
+    std::string magic(sizeof(MAGIC) - 1, '\0');
+    std::uint64_t key_length{};
+    if (!file.read(magic.data(), magic.size()) || magic != MAGIC ||
+        !read_pod(file, key_length) || key_length != key.size()) {
+        return {};
+    }
+    std::string stored_key(key_length, '\0');
+    if (!file.read(stored_key.data(), key_length) || stored_key != key) {
+        return {};
+    }
+
+    Entry entry;
+    std::uint64_t vector_length{};
+    if (!read_pod(file, entry.eigen_value) ||
+        !read_pod(file, entry.iteration_number) ||
+        !read_pod(file, entry.converged) ||
+        !read_pod(file, vector_length)) {
+        return {};
+    }
+    entry.eigen_vector.resize(vector_length);
+    if (!file.read(reinterpret_cast<char*>(entry.eigen_vector.data()),
+                   vector_length * sizeof(entry.eigen_vector[0]))) {
+        return {};
+    }
+    return entry;
+}
+
+void ResultCache::store(const std::string& key, const Entry& entry) const {
+    const auto path = file_path(key);
+    auto tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(std::hash<std::thread::id>{}(
+                             std::this_thread::get_id()));
+    {
+        std::ofstream file(tmp_path, std::ios::binary);
+        file.write(MAGIC, sizeof(MAGIC) - 1);
+        write_pod(file, static_cast<std::uint64_t>(key.size()));
+        file.write(key.data(), key.size());
+        write_pod(file, entry.eigen_value);
+        write_pod(file, entry.iteration_number);
+        write_pod(file, entry.converged);
+        write_pod(file, static_cast<std::uint64_t>(entry.eigen_vector.size()));
+        file.write(reinterpret_cast<const char*>(entry.eigen_vector.data()),
+                   entry.eigen_vector.size() * sizeof(entry.eigen_vector[0]));
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tmp_path);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp_path, path);
+}
+
+std::filesystem::path ResultCache::file_path(const std::string& key) const {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0') << hash(key)
+        << ".bin";
+    return directory / oss.str();
+}
+
+void ResultCache::canonical(std::ostream& os,
+                            const util::json::Value& val,
+                            bool top_level) {
+    using util::json::ValueCategory;
+    switch (val.value_category()) {
+        case ValueCategory::Object: {
+            std::vector<std::string> keys;
+            for (const auto& [key, v] : val.as_object()) {
+                if (!top_level || !is_ignored_key(key)) { keys.push_back(key); }
+            }
+            std::sort(keys.begin(), keys.end());
+            os << '{';
+            for (const auto& key : keys) {
+                os << '"' << key << "\":";
+                canonical(os, val.at(key), false);
+                os << ',';
+            }
+            os << '}';
+            break;
+        }
+        case ValueCategory::Array:
+            os << '[';
+            for (const auto& v : val.as_array()) {
+                canonical(os, v, false);
+                os << ',';
+            }
+            os << ']';
+            break;
+        case ValueCategory::NumberInt:
+        case ValueCategory::NumberFloat:
+            // 1 and 1.0 are the same input
+            os << val.as_number<double>();
+            break;
+        default:
+            os << val.dump();
+    }
+}
@@ -0,0 +1,186 @@
+#include "ResultStream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using util::json::Value;
+using util::json::ValueCategory;
+
+namespace {
+// digits to read back the same double, so that scan values and eigenvalues
+// resume exactly
+constexpr int FULL_PRECISION = 17;
+
+// input keys that do not change results of a point, or describe scan
+// ranges which may be extended on resume
+bool is_ignored_key(const std::string& key, const Value& val) {
+    return val.is_object() || key.starts_with("_comment") ||
+           key == "scan_concurrency" || key == "result_cache" ||
+           key == "output_stream" || key == "output_stream_sync" ||
+           key == "profile_trace" || key == "perf_counters" ||
+           key == "memory_report" || key == "huge_pages" ||
+           key == "thread_placement" || key == "thread_cores" ||
+           key.starts_with("eigen_matrix_");
+}
+
+bool same_value(const Value& a, const Value& b, bool top_level) {
+    if (a.is_number() && b.is_number()) {
+        return a.as_number<double>() == b.as_number<double>();
+    }
+    if (a.value_category() != b.value_category()) { return false; }
+    switch (a.value_category()) {
+        case ValueCategory::Object: {
+            auto count = [&](const Value& obj) {
+                std::size_t n = 0;
+                for (const auto& [key, val] : obj.as_object()) {
+                    n += !(top_level && is_ignored_key(key, val));
+                }
+                return n;
+            };
+            if (count(a) != count(b)) { return false; }
+            for (const auto& [key, val] : a.as_object()) {
+                if (top_level && is_ignored_key(key, val)) { continue; }
+                if (!b.as_object().contains(key) ||
+                    !same_value(val, b.at(key), false)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ValueCategory::Array:
+            if (a.size() != b.size()) { return false; }
+            for (std::size_t i = 0; i < a.size(); ++i) {
+                if (!same_value(a.at(i), b.at(i), false)) { return false; }
+            }
+            return true;
+        default:
+            return a.dump() == b.dump();
+    }
+}
+}  // namespace
+
+ResultStream::ResultStream(const std::string& file_name,
+                           const Value& input,
+                           std::size_t sync_interval_)
+    : fd(-1), sync_interval(sync_interval_) {
+    // read completed points, up to the last complete line
+    off_t valid_length = 0;
+    bool resume = false;
+    {
+        std::ifstream ifs(file_name);
+        std::string line;
+        if (std::getline(ifs, line) && !ifs.eof()) {
+            try {
+                auto header = util::json::parse(line);
+                resume = header.as_object().contains("version") &&
+                         static_cast<double>(header.at("version")) ==
+                             VERSION &&
+                         same_value(header.at("input"), input, true);
+            } catch (const std::exception&) {}
+        }
+        if (resume) {
+            valid_length = line.size() + 1;
+            while (std::getline(ifs, line) && !ifs.eof()) {
+                try {
+                    auto point = util::json::parse(line);
+                    completed_points.insert_or_assign(
+                        point_id(point.at("scan_key"),
+                                 point.at("scan_value")),
+                        std::move(point.at("result")));
+                } catch (const std::exception&) { break; }
+                valid_length += line.size() + 1;
+            }
+        }
+    }
+
+    // never truncate points which can not be resumed, but keep them aside
+    std::error_code ec;
+    if (!resume && std::filesystem::file_size(file_name, ec) > 0 && !ec) {
+        std::string aside;
+        for (int i = 1;; ++i) {
+            aside = file_name + '.' + std::to_string(i);
+            if (!std::filesystem::exists(aside)) { break; }
+        }
+        std::filesystem::rename(file_name, aside);
+        std::cout << file_name << " is of another version or input, moved to " << aside
+                  << '\n';
+    }
+
+    fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0 ||
+        ::ftruncate(fd, resume ? valid_length : 0) != 0 ||
+        ::lseek(fd, 0, SEEK_END) < 0) {
+        throw std::runtime_error("Can not open '" + file_name +
+                                 "' for write: " + std::strerror(errno));
+    }
+    if (resume) {
+        std::cout << "Resume from " << completed_points.size()
+                  << " points in " << file_name << '\n';
+    } else {
+        auto header = Value::create_object();
+        header["version"] = static_cast<int>(VERSION);
+        header["input"] = input.clone();
+        write_line(header.dump(FULL_PRECISION));
+        ::fsync(fd);
+    }
+}
+
+ResultStream::~ResultStream() {
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::optional<Value> ResultStream::completed(const std::string& scan_key,
+                                             const Value& scan_value) const {
+    auto iter = completed_points.find(point_id(scan_key, scan_value));
+    if (iter == completed_points.end()) { return {}; }
+    return iter->second.clone();
+}
+
+void ResultStream::append(const std::string& scan_key,
+                          const Value& scan_value,
+                          const Value& result) {
+    auto point = Value::create_object();
+    point["scan_key"] = scan_key;
+    point["scan_value"] = scan_value.clone();
+    point["result"] = result.clone();
+    const auto line = point.dump(FULL_PRECISION);
+
+    std::lock_guard lk(write_mutex);
+    write_line(line);
+    if (sync_interval != 0 && ++unsynced >= sync_interval) {
+        ::fsync(fd);
+        unsynced = 0;
+    }
+}
+
+std::string ResultStream::point_id(const std::string& scan_key,
+                                   const Value& scan_value) {
+    return scan_key + '\n' + scan_value.dump(FULL_PRECISION);
+}
+
+void ResultStream::write_line(const std::string& line) {
+    // one write call per line, a reader never sees half of it unless the
+    // run is killed in between
+    const auto content = line + '\n';
+    std::size_t written = 0;
+    while (written < content.size()) {
+        const auto n =
+            ::write(fd, content.data() + written, content.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            throw std::runtime_error(std::string("Result stream: ") +
+                                     std::strerror(errno));
+        }
+        written += n;
+    }
+}
@@ -0,0 +1,243 @@
+#include "ThreadPlacement.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include "DedicatedThreadPool.h"
+#include "HugePages.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#endif
+
+namespace {
+#ifdef __linux__
+// "0-3,8,10-11"
+std::vector<unsigned> parse_cpulist(const std::string& list) {
+    std::vector<unsigned> result;
+    std::istringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") { continue; }
+        const auto dash = range.find('-');
+        const auto first = std::stoul(range.substr(0, dash));
+        const auto last = dash == std::string::npos
+                              ? first
+                              : std::stoul(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; ++cpu) {
+            result.push_back(static_cast<unsigned>(cpu));
+        }
+    }
+    return result;
+}
+
+// -1 if the file is missing
+long read_number(const std::string& path) {
+    std::ifstream file(path);
+    long value;
+    return file >> value ? value : -1;
+}
+
+const std::map<unsigned, unsigned>& node_map() {
+    static const auto nodes = [] {
+        std::map<unsigned, unsigned> result;
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        for (const auto& entry :
+             fs::directory_iterator("/sys/devices/system/node", ec)) {
+            const auto name = entry.path().filename().string();
+            if (!name.starts_with("node") ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                continue;
+            }
+            std::ifstream file(entry.path() / "cpulist");
+            std::string list;
+            std::getline(file, list);
+            for (auto cpu : parse_cpulist(list)) {
+                result[cpu] = static_cast<unsigned>(std::stoul(name.substr(4)));
+            }
+        }
+        return result;
+    }();
+    return nodes;
+}
+
+std::vector<unsigned> allowed_cpus() {
+    std::vector<unsigned> result;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) { return result; }
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) { result.push_back(cpu); }
+    }
+    return result;
+}
+
+// 0 for pinned, else errno
+int pin_current_thread(const cpu_set_t& set) {
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Write one byte of every page of [ptr, ptr + size) from the worker whose
+// worker_block holds the start of the page
+void touch_by_workers(void* ptr, std::size_t size) {
+    static const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    auto& pool = DedicatedThreadPool<void>::get_instance();
+    auto bytes = static_cast<volatile unsigned char*>(ptr);
+    pool.for_each_worker([&](std::size_t worker) {
+        const auto [begin, end] =
+            pool.worker_block(std::size_t{0}, size, worker);
+        for (auto i = (begin + page - 1) / page * page; i < end; i += page) {
+            bytes[i] = 0;
+        }
+    });
+}
+#endif
+}  // namespace
+
+ThreadPlacement::Policy ThreadPlacement::parse_policy(std::string_view name) {
+    for (auto policy : {Policy::compact, Policy::scatter}) {
+        if (name == ThreadPlacement::name(policy)) { return policy; }
+    }
+    throw std::invalid_argument("Thread placement '" + std::string(name) +
+                                "' is not one of compact and scatter.");
+}
+
+const char* ThreadPlacement::name(Policy policy) {
+    switch (policy) {
+        case Policy::compact:
+            return "compact";
+        case Policy::scatter:
+            return "scatter";
+    }
+    return "";
+}
+
+unsigned ThreadPlacement::node_of([[maybe_unused]] unsigned cpu) {
+#ifdef __linux__
+    const auto& nodes = node_map();
+    if (const auto it = nodes.find(cpu); it != nodes.end()) {
+        return it->second;
+    }
+#endif
+    return 0;
+}
+
+std::vector<unsigned> ThreadPlacement::cpus([[maybe_unused]] Policy policy) {
+#ifdef __linux__
+    struct cpu_info {
+        unsigned cpu;
+        unsigned node;
+        long package;
+        long core;
+        // rank among hardware threads of the same core
+        unsigned smt;
+    };
+    std::vector<cpu_info> infos;
+    for (auto cpu : allowed_cpus()) {
+        const auto topology =
+            "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        infos.push_back({cpu, node_of(cpu),
+                         read_number(topology + "physical_package_id"),
+                         read_number(topology + "core_id"), 0});
+    }
+    // infos is sorted by cpu, so a sibling with a lower number comes first
+    for (auto& info : infos) {
+        info.smt = static_cast<unsigned>(
+            std::count_if(infos.begin(), infos.end(), [&](const auto& other) {
+                return other.package == info.package &&
+                       other.core == info.core && other.cpu < info.cpu &&
+                       info.core != -1;
+            }));
+    }
+    std::stable_sort(infos.begin(), infos.end(),
+                     [](const auto& a, const auto& b) {
+                         return std::tie(a.node, a.smt, a.package) <
+                                std::tie(b.node, b.smt, b.package);
+                     });
+
+    std::vector<unsigned> result;
+    if (policy == Policy::compact) {
+        for (const auto& info : infos) { result.push_back(info.cpu); }
+        return result;
+    }
+    // scatter: take the next CPU of every node in turn
+    std::map<unsigned, std::vector<unsigned>> by_node;
+    for (const auto& info : infos) { by_node[info.node].push_back(info.cpu); }
+    for (std::size_t i = 0; result.size() < infos.size(); ++i) {
+        for (const auto& [node, node_cpus] : by_node) {
+            if (i < node_cpus.size()) { result.push_back(node_cpus[i]); }
+        }
+    }
+    return result;
+#else
+    return {};
+#endif
+}
+
+bool ThreadPlacement::pin_workers([[maybe_unused]] const std::vector<unsigned>&
+                                      cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
+        std::cerr << "No CPU to pin worker threads to.\n";
+        return false;
+    }
+    // one worker per CPU, unless the pool was made before
+    auto& pool = DedicatedThreadPool<void>::get_instance(cpus.size());
+    if (pool.thread_num() > cpus.size()) {
+        std::cerr << "Can not pin " << pool.thread_num() << " workers to "
+                  << cpus.size() << " CPUs, workers are left unpinned.\n";
+        return false;
+    }
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<int> errors(pool.thread_num());
+    pool.for_each_worker([&](std::size_t worker) {
+        const auto cpu = cpus[worker];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpu < CPU_SETSIZE) { CPU_SET(cpu, &set); }
+        errors[worker] = pin_current_thread(set);
+    });
+    for (std::size_t worker = 0; worker < errors.size(); ++worker) {
+        if (errors[worker] != 0) {
+            std::cerr << "Can not pin worker " << worker << " to CPU "
+                      << cpus[worker] << ": "
+                      << std::strerror(errors[worker])
+                      << ", workers are left unpinned.\n";
+            pool.for_each_worker(
+                [&](std::size_t) { pin_current_thread(allowed); });
+            return false;
+        }
+    }
+
+    std::cout << "Workers pinned to CPUs";
+    for (std::size_t worker = 0; worker < errors.size(); ++worker) {
+        std::cout << ' ' << cpus[worker];
+    }
+    std::cout << "\n        on NUMA nodes";
+    for (std::size_t worker = 0; worker < errors.size(); ++worker) {
+        std::cout << ' ' << node_of(cpus[worker]);
+    }
+    std::cout << '\n';
+    HugePages::set_first_touch(touch_by_workers);
+    pinning.store(true, std::memory_order_relaxed);
+    return true;
+#else
+    std::cerr << "Worker threads are only pinned on Linux.\n";
+    return false;
+#endif
+}
@@ -1,48 +1,270 @@
 #include "Timer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 using namespace std::chrono;
 
-void Timer::start_timing(std::string func_name) {
-    current_func_name = func_name;
-    auto emplace_reuslt = time_consuming.emplace(
-        func_name, std::make_pair(high_resolution_clock::duration::zero(),
-                                  high_resolution_clock::now()));
-    if (emplace_reuslt.second) {
-        entries.push_back(func_name);
-    } else {
-        emplace_reuslt.first->second.second = high_resolution_clock::now();
+namespace {
+constexpr std::uint32_t NONE = static_cast<std::uint32_t>(-1);
+
+struct string_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+// Zone names and timers of all threads
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::unordered_map<std::string,
+                       Timer::zone_id,
+                       string_hash,
+                       std::equal_to<>>
+        ids;
+    std::vector<std::unique_ptr<Timer>> timers;
+    const Timer::clock::time_point start = Timer::clock::now();
+};
+
+// Never destroyed, threads of the pool may still run at exit
+Registry& registry() {
+    static auto& r = *new Registry;
+    return r;
+}
+
+std::vector<std::string> zone_names() {
+    auto& r = registry();
+    std::lock_guard lk(r.mutex);
+    return r.names;
+}
+
+std::atomic<bool> tracing{};
+std::mutex merge_mutex;
+
+// element-wise max
+void raise(MemoryAccount::bytes& to, const MemoryAccount::bytes& from) {
+    for (std::size_t i = 0; i < to.size(); ++i) {
+        to[i] = std::max(to[i], from[i]);
+    }
+}
+
+double in_seconds(Timer::clock::duration d) {
+    return duration<double, seconds::period>(d).count();
+}
+
+void print_rule(std::size_t name_length, std::size_t column_number) {
+    std::cout << '+';
+    for (std::size_t i = 0; i < name_length + 2; ++i) { std::cout << '-'; }
+    for (std::size_t i = 0; i < column_number; ++i) {
+        std::cout << "+-------------";
+    }
+    std::cout << "+\n";
+}
+}  // namespace
+
+Timer::Timer(std::size_t thread_idx_)
+    : thread_idx(thread_idx_), nodes(root_tree()) {}
+
+Timer::zone_id Timer::intern(std::string_view name) {
+    auto& r = registry();
+    std::lock_guard lk(r.mutex);
+    if (auto it = r.ids.find(name); it != r.ids.end()) { return it->second; }
+    const auto id = static_cast<zone_id>(r.names.size());
+    r.names.emplace_back(name);
+    r.ids.emplace(r.names.back(), id);
+    return id;
+}
+
+Timer& Timer::get_timer() {
+    static thread_local Timer* timer = []() {
+        auto& r = registry();
+        std::lock_guard lk(r.mutex);
+        r.timers.emplace_back(new Timer(r.timers.size()));
+        return r.timers.back().get();
+    }();
+    return *timer;
+}
+
+void Timer::start_timing(std::string_view func_name) {
+    const auto id = intern(func_name);
+    for (auto i = stack.size(); i-- > 0;) {
+        if (nodes[stack[i].node].zone == id) {
+            close(i);
+            break;
+        }
     }
+    open(id);
 }
 
-void Timer::pause_and_start(std::string func_name) {
+void Timer::pause_and_start(std::string_view func_name) {
     pause_timing();
     start_timing(func_name);
 }
 
 void Timer::pause_timing() {
-    auto end_time = high_resolution_clock::now();
-    auto elapsed_time = end_time - time_consuming.at(current_func_name).second;
-    time_consuming.at(current_func_name).first += elapsed_time;
+    if (!stack.empty()) { close(stack.size() - 1); }
 }
 
-void Timer::pause_timing(std::string func_name) {
-    auto end_time = high_resolution_clock::now();
-    auto elapsed_time = end_time - time_consuming.at(func_name).second;
-    time_consuming.at(func_name).first += elapsed_time;
+void Timer::pause_timing(std::string_view func_name) {
+    const auto id = intern(func_name);
+    for (auto i = stack.size(); i-- > 0;) {
+        if (nodes[stack[i].node].zone == id) {
+            close(i);
+            return;
+        }
+    }
 }
 
 void Timer::reset() {
-    entries.clear();
-    time_consuming.clear();
+    nodes = root_tree();
+    for (const auto& zone : stack) {
+        if (zone.window != MemoryAccount::NO_WINDOW) {
+            MemoryAccount::close_window(zone.window);
+        }
+    }
+    stack.clear();
+    std::lock_guard lk(merge_mutex);
+    merged.clear();
+}
+
+void Timer::merge(const Timer& other) {
+    if (&other == this) { return; }
+    std::lock_guard lk(merge_mutex);
+    if (merged.empty()) { merged = root_tree(); }
+    add_tree(merged, other.nodes);
+    if (!other.merged.empty()) { add_tree(merged, other.merged); }
+}
+
+std::size_t Timer::open(zone_id id) {
+    const auto parent = stack.empty() ? 0 : stack.back().node;
+    const auto idx = child(nodes, parent, id);
+    const auto window = MemoryAccount::enabled() ? MemoryAccount::open_window()
+                                                 : MemoryAccount::NO_WINDOW;
+    if (!PerfCounters::enabled()) {
+        stack.push_back({idx, clock::now(), {}, window});
+        return stack.size() - 1;
+    }
+    const auto counters = PerfCounters::read();
+    stack.push_back({idx, clock::now(), counters, window});
+    return stack.size() - 1;
+}
+
+void Timer::close(std::size_t depth) {
+    if (stack.size() <= depth) { return; }
+    const auto end = clock::now();
+    const bool counting = PerfCounters::enabled();
+    const auto counters =
+        counting ? PerfCounters::read() : PerfCounters::values{};
+    const bool trace = tracing.load(std::memory_order_relaxed);
+    // zones without a window take current bytes at close
+    const auto memory = MemoryAccount::enabled() ? MemoryAccount::current()
+                                                 : MemoryAccount::bytes{};
+    while (stack.size() > depth) {
+        const auto& [idx, start, start_counters, window] = stack.back();
+        nodes[idx].total += end - start;
+        ++nodes[idx].count;
+        for (std::size_t i = 0; counting && i < counters.size(); ++i) {
+            nodes[idx].counters[i] += counters[i] - start_counters[i];
+        }
+        raise(nodes[idx].memory, window == MemoryAccount::NO_WINDOW
+                                     ? memory
+                                     : MemoryAccount::close_window(window));
+        if (trace) { events.push_back({nodes[idx].zone, start, end}); }
+        stack.pop_back();
+    }
+}
+
+std::vector<Timer::node> Timer::call_tree() const {
+    auto tree = nodes;
+    std::lock_guard lk(merge_mutex);
+    if (!merged.empty()) { add_tree(tree, merged); }
+    return tree;
+}
+
+std::vector<Timer::node> Timer::root_tree() {
+    return {node{NONE, NONE, NONE, NONE, clock::duration::zero(), 0, {}, {}}};
+}
+
+std::uint32_t Timer::child(std::vector<node>& tree,
+                           std::uint32_t parent,
+                           zone_id id) {
+    auto last = NONE;
+    for (auto idx = tree[parent].first_child; idx != NONE;
+         idx = tree[idx].next_sibling) {
+        if (tree[idx].zone == id) { return idx; }
+        last = idx;
+    }
+    const auto idx = static_cast<std::uint32_t>(tree.size());
+    tree.push_back(
+        {id, parent, NONE, NONE, clock::duration::zero(), 0, {}, {}});
+    (last == NONE ? tree[parent].first_child : tree[last].next_sibling) = idx;
+    return idx;
+}
+
+void Timer::add_tree(std::vector<node>& to, const std::vector<node>& from) {
+    // parents come before children
+    std::vector<std::uint32_t> idx_in_to(from.size());
+    for (std::size_t i = 1; i < from.size(); ++i) {
+        idx_in_to[i] = child(to, idx_in_to[from[i].parent], from[i].zone);
+        auto& n = to[idx_in_to[i]];
+        n.total += from[i].total;
+        n.count += from[i].count;
+        for (std::size_t j = 0; j < n.counters.size(); ++j) {
+            n.counters[j] += from[i].counters[j];
+        }
+        raise(n.memory, from[i].memory);
+    }
+}
+
+std::vector<Timer::node> Timer::zone_totals(const std::vector<node>& tree,
+                                            std::size_t zone_number,
+                                            std::vector<zone_id>& order) {
+    std::vector<node> totals(zone_number,
+                             {NONE, NONE, NONE, NONE, clock::duration::zero(),
+                              0, PerfCounters::values{},
+                              MemoryAccount::bytes{}});
+    std::vector<bool> seen(zone_number);
+    for (std::size_t i = 1; i < tree.size(); ++i) {
+        const auto zone = tree[i].zone;
+        bool nested = false;
+        for (auto p = tree[i].parent; p != 0 && !nested; p = tree[p].parent) {
+            nested = tree[p].zone == zone;
+        }
+        if (nested) { continue; }
+        if (!seen[zone]) {
+            seen[zone] = true;
+            order.push_back(zone);
+        }
+        auto& total = totals[zone];
+        total.zone = zone;
+        total.total += tree[i].total;
+        total.count += tree[i].count;
+        for (std::size_t j = 0; j < total.counters.size(); ++j) {
+            total.counters[j] += tree[i].counters[j];
+        }
+        raise(total.memory, tree[i].memory);
+    }
+    return totals;
 }
 
 void Timer::print() {
+    const auto tree = call_tree();
+    const auto names = zone_names();
+    std::vector<zone_id> entries;
+    const auto totals = zone_totals(tree, names.size(), entries);
+
     std::size_t max_length = 0;
-    for (auto& name : entries) {
-        max_length = max_length < name.size() ? name.size() : max_length;
+    for (auto zone : entries) {
+        max_length = std::max(max_length, names[zone].size());
     }
 
     std::cout << '+';
@@ -53,19 +275,268 @@ void Timer::print() {
     std::cout << "|\n+";
     for (std::size_t i = 0; i < max_length; ++i) { std::cout << "-"; }
     std::cout << "--+-------------+\n";
-    for (const auto& name : entries) {
-        auto& time_used = time_consuming.at(name).first;
-        std::cout << std::left << "| " << std::setw(max_length) << name << " | "
-                  << std::setw(11)
-                  << duration<double, seconds::period>(time_used).count()
+    for (auto zone : entries) {
+        std::cout << std::left << "| " << std::setw(max_length) << names[zone]
+                  << " | " << std::setw(11) << in_seconds(totals[zone].total)
                   << "s|\n";
     }
     std::cout << '+';
     for (std::size_t i = 0; i < max_length; ++i) { std::cout << "-"; }
     std::cout << "--+-------------+\n";
+
+    // call tree, depth first, a name indented by two spaces per level
+    std::vector<std::pair<std::uint32_t, std::size_t>> rows;
+    std::function<void(std::uint32_t, std::size_t)> walk =
+        [&](std::uint32_t parent, std::size_t depth) {
+            for (auto idx = tree[parent].first_child; idx != NONE;
+                 idx = tree[idx].next_sibling) {
+                rows.emplace_back(idx, depth);
+                walk(idx, depth + 1);
+            }
+        };
+    walk(0, 0);
+    const std::string tree_title = "Call tree";
+    std::size_t tree_length = tree_title.size();
+    for (const auto& [idx, depth] : rows) {
+        tree_length =
+            std::max(tree_length, 2 * depth + names[tree[idx].zone].size());
+    }
+
+    std::cout << '\n';
+    print_rule(tree_length, 3);
+    std::cout << std::left << std::setw(tree_length + 3) << "| " + tree_title
+              << "| Time        | Count       | Of parent   |\n";
+    print_rule(tree_length, 3);
+    for (const auto& [idx, depth] : rows) {
+        const auto& n = tree[idx];
+        std::cout << "| " << std::left << std::setw(tree_length)
+                  << std::string(2 * depth, ' ') + names[n.zone] << " | "
+                  << std::setw(11) << in_seconds(n.total) << "s| "
+                  << std::setw(11) << n.count << " | ";
+        if (n.parent != 0 && tree[n.parent].total.count() != 0) {
+            std::cout << std::setw(10)
+                      << 100. * in_seconds(n.total) /
+                             in_seconds(tree[n.parent].total)
+                      << "%|\n";
+        } else {
+            std::cout << std::setw(11) << "" << "|\n";
+        }
+    }
+    print_rule(tree_length, 3);
 }
 
-Timer& Timer::get_timer() {
-    static Timer timer{};
-    return timer;
+void Timer::print_threads() {
+    auto& r = registry();
+    std::vector<std::string> names;
+    // [thread][zone]
+    std::vector<std::vector<node>> totals;
+    std::vector<std::vector<zone_id>> timed;
+    {
+        std::lock_guard lk(r.mutex);
+        names = r.names;
+        for (const auto& timer : r.timers) {
+            timed.emplace_back();
+            totals.push_back(
+                zone_totals(timer->nodes, names.size(), timed.back()));
+        }
+    }
+
+    std::vector<std::size_t> thread_number(names.size());
+    std::vector<zone_id> entries;
+    for (const auto& zones : timed) {
+        for (auto zone : zones) {
+            if (++thread_number[zone] == 2) { entries.push_back(zone); }
+        }
+    }
+    if (entries.empty()) { return; }
+
+    const std::string title = "Time per thread";
+    std::size_t max_length = title.size();
+    for (auto zone : entries) {
+        max_length = std::max(max_length, names[zone].size());
+    }
+    std::cout << '\n';
+    print_rule(max_length, 5);
+    std::cout << std::left << std::setw(max_length + 3) << "| " + title
+              << "| Threads     | Min         | Mean        | Max         "
+                 "| Max / mean  |\n";
+    print_rule(max_length, 5);
+    for (auto zone : entries) {
+        double min = 0, max = 0, sum = 0;
+        bool first = true;
+        for (std::size_t t = 0; t < totals.size(); ++t) {
+            if (std::find(timed[t].begin(), timed[t].end(), zone) ==
+                timed[t].end()) {
+                continue;
+            }
+            const auto s = in_seconds(totals[t][zone].total);
+            min = first ? s : std::min(min, s);
+            max = first ? s : std::max(max, s);
+            sum += s;
+            first = false;
+        }
+        const auto mean = sum / thread_number[zone];
+        std::cout << "| " << std::left << std::setw(max_length) << names[zone]
+                  << " | " << std::setw(11) << thread_number[zone] << " | "
+                  << std::setw(11) << min << "s| " << std::setw(11) << mean
+                  << "s| " << std::setw(11) << max << "s| " << std::setw(11)
+                  << (mean > 0 ? max / mean : 1.) << " |\n";
+    }
+    print_rule(max_length, 5);
+}
+
+std::vector<Timer::zone_summary> Timer::summary() {
+    auto& r = registry();
+    auto tree = root_tree();
+    std::vector<std::string> names;
+    {
+        std::lock_guard lk(r.mutex);
+        names = r.names;
+        for (const auto& timer : r.timers) {
+            add_tree(tree, timer->nodes);
+            std::lock_guard merge_lk(merge_mutex);
+            if (!timer->merged.empty()) { add_tree(tree, timer->merged); }
+        }
+    }
+
+    std::vector<zone_id> order;
+    const auto totals = zone_totals(tree, names.size(), order);
+    std::vector<zone_summary> result;
+    for (auto zone : order) {
+        const auto& total = totals[zone];
+        result.push_back({names[zone], in_seconds(total.total), total.count,
+                          total.counters, total.memory});
+    }
+    return result;
+}
+
+void Timer::print_counters() {
+    if (!PerfCounters::enabled()) { return; }
+    const auto zones = summary();
+
+    const std::string title = "Hardware counters";
+    std::size_t max_length = title.size();
+    for (const auto& zone : zones) {
+        max_length = std::max(max_length, zone.name.size());
+    }
+    auto cell = [](auto value) {
+        std::cout << ' ' << std::setw(11) << value << " |";
+    };
+    // ratio of two counters, or n/a if either is not counted
+    auto ratio = [&](const zone_summary& zone, PerfCounters::Counter a,
+                     PerfCounters::Counter b, double scale) {
+        if (!PerfCounters::available(a) || !PerfCounters::available(b) ||
+            zone.counters[b] == 0) {
+            cell("n/a");
+        } else {
+            cell(scale * static_cast<double>(zone.counters[a]) /
+                 static_cast<double>(zone.counters[b]));
+        }
+    };
+
+    std::cout << '\n';
+    print_rule(max_length, 6);
+    std::cout << std::left << "| " << std::setw(max_length) << title << " |";
+    for (const char* head : {"Cycles", "Instrs", "IPC", "LLC miss/ki",
+                             "Br miss/ki", "FP vector %"}) {
+        cell(head);
+    }
+    std::cout << '\n';
+    print_rule(max_length, 6);
+    for (const auto& zone : zones) {
+        std::cout << "| " << std::setw(max_length) << zone.name << " |";
+        for (auto counter :
+             {PerfCounters::cycles, PerfCounters::instructions}) {
+            if (PerfCounters::available(counter)) {
+                cell(static_cast<double>(zone.counters[counter]));
+            } else {
+                cell("n/a");
+            }
+        }
+        ratio(zone, PerfCounters::instructions, PerfCounters::cycles, 1.);
+        ratio(zone, PerfCounters::llc_misses, PerfCounters::instructions, 1e3);
+        ratio(zone, PerfCounters::branch_misses, PerfCounters::instructions,
+              1e3);
+        ratio(zone, PerfCounters::fp_vector, PerfCounters::instructions, 1e2);
+        std::cout << '\n';
+    }
+    print_rule(max_length, 6);
+    std::cout << "Summed over all threads, misses per 1000 instructions.\n";
+}
+
+void Timer::print_memory() {
+    if (!MemoryAccount::enabled()) { return; }
+    const auto zones = summary();
+
+    const std::string title = "Peak memory (MiB)";
+    const std::string whole_run = "Whole run";
+    std::size_t max_length = std::max(title.size(), whole_run.size());
+    for (const auto& zone : zones) {
+        max_length = std::max(max_length, zone.name.size());
+    }
+    auto row = [&](const std::string& name, const MemoryAccount::bytes& b) {
+        std::cout << "| " << std::setw(max_length) << name << " |";
+        for (auto value : b) {
+            std::cout << ' ' << std::setw(11)
+                      << static_cast<double>(value) / (1 << 20) << " |";
+        }
+        std::cout << '\n';
+    };
+
+    const auto columns = MemoryAccount::TAG_NUMBER + 1;
+    std::cout << '\n';
+    print_rule(max_length, columns);
+    std::cout << std::left << "| " << std::setw(max_length) << title << " |";
+    for (std::size_t i = 0; i < columns; ++i) {
+        std::cout << ' ' << std::setw(11) << MemoryAccount::name(i) << " |";
+    }
+    std::cout << '\n';
+    print_rule(max_length, columns);
+    for (const auto& zone : zones) { row(zone.name, zone.memory); }
+    print_rule(max_length, columns);
+    row(whole_run, MemoryAccount::peak());
+    print_rule(max_length, columns);
+    std::cout << "Peak of each column on its own, held by all threads while "
+                 "a zone is open.\n";
+}
+
+void Timer::enable_trace() {
+    tracing.store(true, std::memory_order_relaxed);
+}
+
+bool Timer::write_trace(const std::string& file_name) {
+    std::ofstream out(file_name);
+    if (!out) { return false; }
+
+    auto escape = [](const std::string& str) {
+        std::string escaped;
+        for (char c : str) {
+            if (c == '"' || c == '\\') { escaped += '\\'; }
+            escaped += c;
+        }
+        return escaped;
+    };
+
+    auto& r = registry();
+    std::lock_guard lk(r.mutex);
+    auto in_us = [](clock::duration d) {
+        return duration<double, std::micro>(d).count();
+    };
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& timer : r.timers) {
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+            << timer->thread_idx << ",\"args\":{\"name\":\"thread "
+            << timer->thread_idx << "\"}}";
+        first = false;
+        for (const auto& e : timer->events) {
+            out << ",\n{\"name\":\"" << escape(r.names[e.zone])
+                << "\",\"cat\":\"emme\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                << timer->thread_idx << ",\"ts\":" << in_us(e.start - r.start)
+                << ",\"dur\":" << in_us(e.end - e.start) << '}';
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
 }
@@ -1,59 +1,248 @@
 #include <complex>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 
+#include "AsyncFileWriter.h"
 #include "Grid.h"
+#include "HugePages.h"
 #include "JsonParser.h"
 #include "Matrix.h"
+#include "MemoryAccount.h"
+#include "PackedSymmetricMatrix.h"
 #include "Parameters.h"
+#include "RecordContainer.h"
+#include "ResultCache.h"
+#include "ResultStream.h"
+#include "PerfCounters.h"
+#include "ThreadPlacement.h"
 #include "Timer.h"
 #include "functions.h"
 #include "singularity_handler.h"
 #include "solver.h"
+#include "solver_contour.h"
 #include "solver_pic.h"
 
 using namespace util::json;
 
-auto solve_once_eigen(const auto& input,
-                      auto& omega_initial_guess,
-                      std::ofstream& eigen_matrix_file) {
-    auto& timer = Timer::get_timer();
-    double tol = input.at("iteration_precision");
+// storage of eigen matrices, counted as MemoryAccount::matrix and backed by
+// huge pages
+using eigen_allocator_type =
+    util::AlignedAllocator<std::complex<double>,
+                           util::Alignment::HUGE_PAGE,
+                           MemoryAccount::matrix>;
 
-    timer.start_timing("initial");
+/**
+ * @brief Destination of eigen matrices or PIC fields of one solve, a file of
+ * its own or records of the container shared by the run.
+ *
+ */
+class DumpOutput {
+   public:
+    using Layout = RecordContainer::Layout;
 
-    auto& para = Parameters::generate(input);
+    // the file is only created by the first write, so that a solve taken
+    // from ResultCache leaves an existing one alone
+    DumpOutput(const Value& input, std::string file_name_)
+        : single_precision(flag(input, "eigen_matrix_single")),
+          compress(flag(input, "eigen_matrix_compress")),
+          file_name(std::move(file_name_)) {}
 
-    auto length = para.length;
-    auto npoints = para.npoints;
+    DumpOutput(const Value& input,
+               RecordContainer& record_container,
+               const std::string& scan_key,
+               const Value& scan_value)
+        : single_precision(flag(input, "eigen_matrix_single")),
+          container(&record_container) {
+        header.data_type = single_precision
+                               ? RecordContainer::DataType::complex64
+                               : RecordContainer::DataType::complex128;
+        scan_key.copy(header.scan_key, sizeof(header.scan_key) - 1);
+        if (scan_value.is_number()) {
+            header.scan_value[header.scan_value_number++] = scan_value;
+        } else if (scan_value.is_array()) {
+            for (std::size_t i = 0; i < scan_value.size() &&
+                                    i < RecordContainer::MAX_SCAN_VALUE;
+                 ++i) {
+                header.scan_value[header.scan_value_number++] =
+                    scan_value.at(i);
+            }
+        }
+    }
 
-    Grid<double> grid_info(length, npoints);
+    // Values go as they are, or rounded to complex<float> to halve the size
+    template <typename T>
+    void write(const std::complex<T>* data, std::size_t n) {
+        if (!single_precision) {
+            put(data, n);
+            return;
+        }
+        static thread_local std::vector<std::complex<float>> rounded;
+        rounded.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            rounded[i] = {static_cast<float>(data[i].real()),
+                          static_cast<float>(data[i].imag())};
+        }
+        put(rounded.data(), n);
+    }
 
-    Matrix<double> coeff_matrix = SingularityHandler(npoints);
+    // Open the record the values written until end_record go to, rows x
+    // cols or the upper triangle of a square matrix. step is the PIC time
+    // step or -1.
+    void begin_record(std::size_t rows,
+                      std::size_t cols,
+                      Layout layout,
+                      std::complex<double> omega,
+                      std::int64_t step) {
+        if (!container) { return; }
+        auto record_header = header;
+        record_header.layout = layout;
+        record_header.rows = rows;
+        record_header.cols = cols;
+        record_header.omega[0] = omega.real();
+        record_header.omega[1] = omega.imag();
+        record_header.step = step;
+        const auto values =
+            layout == Layout::upper ? rows * (rows + 1) / 2 : rows * cols;
+        record_header.data_size =
+            values * RecordContainer::value_size(header.data_type);
+        record.emplace(container->begin_record(record_header));
+    }
+
+    void end_record() {
+        if (!record) { return; }
+        records.push_back(record->finish());
+        record.reset();
+    }
+
+    // Discard everything written so far
+    void truncate() {
+        if (!container) {
+            if (file) { file->truncate(); }
+            return;
+        }
+        // an open record is discarded when closed
+        record.reset();
+        for (auto idx : records) { container->discard(idx); }
+        records.clear();
+    }
+
+    // Record where the output went to result, nothing if nothing was written.
+    // Waits for the writes so that a failure of the last one shows.
+    void describe(Value& result) {
+        if (container ? records.empty() : !file) { return; }
+        if (file) {
+            file->flush();
+        } else {
+            container->flush();
+        }
+        const auto& name = file ? file->file_name() : container->file_name();
+        const bool good = file ? static_cast<bool>(*file)
+                               : static_cast<bool>(*container);
+        result["eigenMatrix"] =
+            good ? name : "Can not open '" + name + "' for write.";
+        if (records.size() == 1) {
+            result["eigenMatrix_record"] = static_cast<int>(records[0]);
+        }
+    }
+
+   private:
+    bool single_precision;
+    bool compress{};
+    std::string file_name;
+    std::optional<AsyncFileWriter> file;
+    RecordContainer* container{};
+    RecordContainer::RecordHeader header{};
+    std::optional<RecordContainer::RecordWriter> record;
+    std::vector<std::size_t> records;
+
+    static bool flag(const Value& input, const char* key) {
+        return input.as_object().contains(key) && input.at(key).as_boolean();
+    }
+
+    template <typename T>
+    void put(const T* data, std::size_t n) {
+        if (!container) {
+            if (!file) { file.emplace(file_name, compress); }
+            file->write(data, n);
+            return;
+        }
+        if (!record) {
+            throw std::logic_error("Dump output written out of a record.");
+        }
+        record->write(data, n * sizeof(T));
+    }
+};
+
+template <typename matrix_type>
+auto solve_eigen_with_storage(const Parameters& para,
+                              const Grid<double>& grid_info,
+                              const Matrix<double>& coeff_matrix,
+                              double tol,
+                              auto& omega_initial_guess,
+                              DumpOutput& eigen_matrix_file,
+                              bool output_upper) {
+    auto& timer = Timer::get_timer();
 
-    auto eigen_solver = EigenSolver<Matrix<std::complex<double>>>(
-        para, omega_initial_guess, coeff_matrix, grid_info);
+    auto eigen_solver = EigenSolver<matrix_type>(para, omega_initial_guess,
+                                                 coeff_matrix, grid_info);
     timer.pause_timing("initial");
 
+    int iteration_number = 0;
+    bool converged = false;
     for (int j = 0; j <= para.iteration_step_limit; j++) {
         timer.start_timing("newtonTracSecantIteration");
         eigen_solver.newtonTraceSecantIteration();
         timer.pause_timing("newtonTracSecantIteration");
+        ++iteration_number;
 
         std::cout << "        " << eigen_solver.eigen_value << '\n';
         if (std::abs(eigen_solver.d_eigen_value) <
             std::abs(tol * eigen_solver.eigen_value)) {
+            converged = true;
             break;
         }
     }
 
     std::cout << "        Eigenvalue: " << eigen_solver.eigen_value << '\n';
+    // while the eigen matrices are mapped, see HugePages::report
+    HugePages::report();
     timer.start_timing("Output");
     auto& v_output = eigen_solver.eigen_matrix;
-    eigen_matrix_file.write(reinterpret_cast<char*>(v_output.data()),
-                            sizeof(v_output(0, 0)) * v_output.size());
+    const std::size_t n = v_output.getRows();
+    eigen_matrix_file.begin_record(
+        n, n,
+        output_upper ? DumpOutput::Layout::upper : DumpOutput::Layout::full,
+        eigen_solver.eigen_value, -1);
+    if constexpr (is_packed_symmetric_v<matrix_type>) {
+        // output file is in full storage unless upper triangle is asked
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto row = v_output.getRow(i);
+            const std::size_t first = output_upper ? i : 0;
+            eigen_matrix_file.write(row.data() + first, n - first);
+        }
+    } else if (output_upper) {
+        // row i from the diagonal on, matrix is symmetric
+        for (std::size_t i = 0; i < n; ++i) {
+            eigen_matrix_file.write(v_output.data() + i * n + i, n - i);
+        }
+    } else {
+        eigen_matrix_file.write(v_output.data(), v_output.size());
+    }
+    eigen_matrix_file.end_record();
 
     // store eigenvalue and eigenvector to result
 
@@ -61,20 +250,136 @@ auto solve_once_eigen(const auto& input,
     auto& eva = single_result["eigenvalue"] = Value::create_array(2);
     eva[0] = eigen_solver.eigen_value.real();
     eva[1] = eigen_solver.eigen_value.imag();
+    single_result["iteration_number"] = iteration_number;
+    single_result["converged"] =
+        Value{ValueCategory::Boolean, new Boolean{converged}};
     timer.pause_timing("Output");
 
-    timer.start_timing("SVD");
+    timer.start_timing("nullSpace");
     single_result["eigenvector"] =
         Value::create_typed_array(eigen_solver.nullSpace());
-    timer.pause_timing("SVD");
+    timer.pause_timing("nullSpace");
 
     omega_initial_guess = eigen_solver.eigen_value;
     return single_result;
 }
 
+auto solve_once_eigen(const auto& input,
+                      auto& omega_initial_guess,
+                      DumpOutput& eigen_matrix_file) {
+    auto& timer = Timer::get_timer();
+    double tol = input.at("iteration_precision");
+    const bool output_upper =
+        input.as_object().contains("eigen_matrix_upper") &&
+        input.at("eigen_matrix_upper").as_boolean();
+
+    timer.start_timing("initial");
+
+    auto& para = Parameters::generate(input);
+
+    auto length = para.length;
+    auto npoints = para.npoints;
+
+    Grid<double> grid_info(length, npoints, para);
+
+    Matrix<double> coeff_matrix = SingularityHandler(npoints);
+
+    if (para.packed_storage) {
+        return solve_eigen_with_storage<
+            PackedSymmetricMatrix<std::complex<double>, eigen_allocator_type>>(
+            para, grid_info, coeff_matrix, tol, omega_initial_guess,
+            eigen_matrix_file, output_upper);
+    }
+    return solve_eigen_with_storage<
+        Matrix<std::complex<double>, eigen_allocator_type>>(
+        para, grid_info, coeff_matrix, tol, omega_initial_guess,
+        eigen_matrix_file, output_upper);
+}
+
+template <typename matrix_type>
+auto solve_contour_with_storage(const auto& input,
+                                const Parameters& para,
+                                const Grid<double>& grid_info,
+                                const Matrix<double>& coeff_matrix,
+                                auto& omega_center) {
+    auto& timer = Timer::get_timer();
+
+    const double radius = input.at("contour_radius");
+    // optional ones
+    std::size_t point_number = 32;
+    std::size_t probe_number = 8;
+    double rank_tol = 1e-4;
+    if (input.as_object().contains("contour_points")) {
+        point_number = input.at("contour_points");
+    }
+    if (input.as_object().contains("contour_probe_number")) {
+        probe_number = input.at("contour_probe_number");
+    }
+    if (input.as_object().contains("contour_rank_tolerance")) {
+        rank_tol = input.at("contour_rank_tolerance");
+    }
+
+    auto contour_solver = ContourSolver<matrix_type>(
+        para, coeff_matrix, grid_info, omega_center, radius, point_number,
+        probe_number, rank_tol);
+    timer.pause_timing("initial");
+
+    auto eigen_pairs = contour_solver.solve();
+    // while the eigen matrices are mapped, see HugePages::report
+    HugePages::report();
+
+    timer.start_timing("Output");
+    auto single_result = Value::create_object();
+    auto& eigenvalues = single_result["eigenvalues"] = Value::create_array();
+    auto& eigenvectors = single_result["eigenvectors"] = Value::create_array();
+    for (const auto& [eigen_value, eigen_vector] : eigen_pairs) {
+        std::cout << "        Eigenvalue: " << eigen_value << '\n';
+        auto eva = Value::create_array(2);
+        eva[0] = eigen_value.real();
+        eva[1] = eigen_value.imag();
+        eigenvalues.as_array().push_back(std::move(eva));
+        eigenvectors.as_array().push_back(
+            Value::create_typed_array(eigen_vector));
+    }
+    single_result["contour_rank"] = static_cast<int>(contour_solver.rank());
+
+    // the one nearest to center, which the next scan point centers at
+    if (eigen_pairs.empty()) {
+        std::cout << "        No eigenvalue inside the contour.\n";
+        single_result["eigenvalue"] = "NaN";
+    } else {
+        single_result["eigenvalue"] = eigenvalues[0].clone();
+        single_result["eigenvector"] = eigenvectors[0].clone();
+        omega_center = eigen_pairs[0].eigen_value;
+    }
+    timer.pause_timing("Output");
+
+    return single_result;
+}
+
+auto solve_once_contour(const auto& input,
+                        auto& omega_center,
+                        DumpOutput&) {
+    auto& timer = Timer::get_timer();
+    timer.start_timing("initial");
+
+    auto& para = Parameters::generate(input);
+    Grid<double> grid_info(para.length, para.npoints, para);
+    Matrix<double> coeff_matrix = SingularityHandler(para.npoints);
+
+    if (para.packed_storage) {
+        return solve_contour_with_storage<
+            PackedSymmetricMatrix<std::complex<double>, eigen_allocator_type>>(
+            input, para, grid_info, coeff_matrix, omega_center);
+    }
+    return solve_contour_with_storage<
+        Matrix<std::complex<double>, eigen_allocator_type>>(
+        input, para, grid_info, coeff_matrix, omega_center);
+}
+
 auto solve_once_pic(const auto& input,
                     auto&,
-                    std::ofstream& eigen_matrix_file) {
+                    DumpOutput& eigen_matrix_file) {
     auto& timer = Timer::get_timer();
     timer.start_timing("Initial");
 
@@ -97,9 +402,13 @@ auto solve_once_pic(const auto& input,
         timer.start_timing("Diagnostics");
         const auto& current_field = state.current_field();
         const auto nf = current_field.size();
-        eigen_matrix_file.write(
-            reinterpret_cast<const char*>(current_field.data()),
-            sizeof(current_field[0]) * nf);
+        eigen_matrix_file.begin_record(
+            1, nf, DumpOutput::Layout::full,
+            {std::numeric_limits<double>::quiet_NaN(),
+             std::numeric_limits<double>::quiet_NaN()},
+            static_cast<std::int64_t>(idx));
+        eigen_matrix_file.write(current_field.data(), nf);
+        eigen_matrix_file.end_record();
 
         auto [real, imag, norm] = std::accumulate(
             current_field.begin(), current_field.end(), std::array<double, 3>{},
@@ -114,6 +423,8 @@ auto solve_once_pic(const auto& input,
         timer.pause_timing("Diagnostics");
     }
 
+    // while the markers are mapped, see HugePages::report
+    HugePages::report();
     auto eigen_value = util::calculate_omega(stats, dt);
     std::cout << "        Eigenvalue: " << eigen_value << '\n';
 
@@ -123,8 +434,9 @@ auto solve_once_pic(const auto& input,
     eva[0] = eigen_value.real();
     eva[1] = eigen_value.imag();
 
-    single_result["eigenvector"] =
-        Value::create_typed_array(state.current_field());
+    const auto& field = state.current_field();
+    single_result["eigenvector"] = Value::create_typed_array(
+        std::vector<std::complex<double>>(field.begin(), field.end()));
 
     return single_result;
 }
@@ -167,21 +479,104 @@ auto get_scan_generator(const auto& para) {
 auto filter_input(const auto& input_all) {
     auto input = input_all.clone();
     for (auto& [key, val] : input.as_object()) {
-        if (val.is_object()) { val = val["head"]; }
+        if (val.is_object()) {
+            val = val.as_object().contains("list") ? val["list"][0]
+                                                   : val["head"];
+        }
     }
     return input;
 }
 
+/**
+ * @brief Predictor of scan continuation. Eigenvalue at next scan value is
+ * extrapolated from the last converged points of a scan branch by Lagrange
+ * polynomial, and sub-step of the scan is adapted to the effort of Newton
+ * iteration.
+ *
+ */
+class ScanContinuation {
+   public:
+    // quadratic extrapolation at most
+    static constexpr std::size_t MAX_HISTORY = 3;
+    static constexpr double MIN_STEP_SCALE = 1. / 16;
+
+    void reset() {
+        history.clear();
+        step_scale = 1.;
+    }
+
+    bool empty() const {
+        return history.empty();
+    }
+
+    double last_value() const {
+        return history.back().first;
+    }
+
+    // a point at a scan value already in history replaces it, as the
+    // Lagrange basis of two equal values is 0 / 0
+    void push(double scan_value, std::complex<double> omega) {
+        std::erase_if(history, [scan_value](const auto& point) {
+            return point.first == scan_value;
+        });
+        if (history.size() == MAX_HISTORY) { history.pop_front(); }
+        history.emplace_back(scan_value, omega);
+    }
+
+    std::complex<double> predict(double scan_value) const {
+        std::complex<double> omega{};
+        for (std::size_t i = 0; i < history.size(); ++i) {
+            double basis = 1.;
+            for (std::size_t j = 0; j < history.size(); ++j) {
+                if (j != i) {
+                    basis *= (scan_value - history[j].first) /
+                             (history[i].first - history[j].first);
+                }
+            }
+            omega += basis * history[i].second;
+        }
+        return omega;
+    }
+
+    // fraction of scan step to take, halved when Newton iteration struggles
+    double step_scale = 1.;
+
+   private:
+    std::deque<std::pair<double, std::complex<double>>> history;
+};
+
+// values of a scan branch and their results
+struct ScanBranch {
+    std::vector<double> values;
+    Value scan_values = Value::create_array();
+    Value scan_results = Value::create_array();
+};
+
+// eigenvalue of a solver result, if it is a converged one
+std::optional<std::complex<double>> converged_eigenvalue(
+    const Value& single_result) {
+    const auto& eva = single_result.at("eigenvalue");
+    if (!eva.is_array()) { return {}; }
+    // only results of Newton iteration have it, see ResultStream::VERSION
+    if (single_result.as_object().contains("converged") &&
+        !single_result.at("converged").as_boolean()) {
+        return {};
+    }
+    return std::complex<double>{eva[0], eva[1]};
+}
+
 int main() {
     std::string filename = "input.json";
     auto input_all = util::json::parse_file(filename);
 
-    auto invoke_solver = [&]<typename... Args>(Args&&... args) {
+    auto invoke_method = [&]<typename... Args>(Args&&... args) {
         std::string method = input_all.at("method");
         if ("eigen" == method) {
             return solve_once_eigen(std::forward<Args>(args)...);
         } else if ("PIC" == method) {
             return solve_once_pic(std::forward<Args>(args)...);
+        } else if ("contour" == method) {
+            return solve_once_contour(std::forward<Args>(args)...);
         }
         std::ostringstream oss;
         oss << "Method '" << input_all.at("method").as_string()
@@ -189,7 +584,100 @@ int main() {
         throw std::runtime_error(oss.str());
     };
 
+    // results of eigen method can be cached on disk, see ResultCache. The
+    // build is told apart by its commit, and also by its build time if the
+    // tree had uncommitted changes, without a commit hash (not built by the
+    // Makefiles) the cache is off.
+    std::optional<ResultCache> result_cache;
+    if (input_all.as_object().contains("result_cache") &&
+        input_all.at("method").as_string() == "eigen") {
+#ifdef EMME_COMMIT_HASH
+        std::string build_hash = EMME_COMMIT_HASH;
+        if (build_hash.ends_with("-dirty")) {
+#ifdef EMME_BUILD_DATE
+            build_hash += std::string(" ") + EMME_BUILD_DATE;
+#else
+            build_hash.clear();
+#endif
+        }
+#else
+        const std::string build_hash;
+#endif
+        if (build_hash.empty()) {
+            std::cerr << "Result cache is off, the build has no commit hash "
+                         "to tell cached results of other builds apart.\n";
+        } else {
+            result_cache.emplace(input_all.at("result_cache").as_string(),
+                                 build_hash);
+        }
+    }
+
+    // A cached solve moves omega to the eigenvalue as the eigen solver does,
+    // but writes no eigen matrix
+    auto invoke_solver = [&](const Value& input, std::complex<double>& omega,
+                             DumpOutput& eigen_matrix_file) {
+        if (!result_cache) {
+            return invoke_method(input, omega, eigen_matrix_file);
+        }
+        const auto cache_key = result_cache->key(input, omega);
+        if (auto entry = result_cache->load(cache_key)) {
+            std::cout << "        Eigenvalue: " << entry->eigen_value
+                      << " (cached)\n";
+            auto single_result = Value::create_object();
+            auto& eva = single_result["eigenvalue"] = Value::create_array(2);
+            eva[0] = entry->eigen_value.real();
+            eva[1] = entry->eigen_value.imag();
+            single_result["iteration_number"] = entry->iteration_number;
+            single_result["converged"] =
+                Value{ValueCategory::Boolean, new Boolean{entry->converged}};
+            single_result["eigenvector"] =
+                Value::create_typed_array(std::move(entry->eigen_vector));
+            omega = entry->eigen_value;
+            return single_result;
+        }
+
+        auto single_result = invoke_method(input, omega, eigen_matrix_file);
+        const auto& eva = single_result.at("eigenvalue");
+        result_cache->store(
+            cache_key,
+            {{eva[0], eva[1]},
+             static_cast<int>(
+                 static_cast<double>(single_result.at("iteration_number"))),
+             single_result.at("converged").as_boolean(),
+             single_result.at("eigenvector")
+                 .as_typed_array<std::complex<double>>()});
+        return single_result;
+    };
+
     auto& timer = Timer::get_timer();
+    if (input_all.as_object().contains("profile_trace")) {
+        Timer::enable_trace();
+    }
+    if (input_all.as_object().contains("perf_counters") &&
+        input_all.at("perf_counters").as_boolean()) {
+        PerfCounters::enable();
+    }
+    if (input_all.as_object().contains("memory_report") &&
+        input_all.at("memory_report").as_boolean()) {
+        MemoryAccount::enable();
+    }
+    if (input_all.as_object().contains("huge_pages")) {
+        HugePages::set_policy(
+            HugePages::parse_policy(input_all.at("huge_pages").as_string()));
+    }
+    // before anything is allocated, so that it is first touched by workers,
+    // and before the pool is used, so that it is made with a worker per CPU
+    if (input_all.as_object().contains("thread_cores")) {
+        std::vector<unsigned> cpus;
+        for (const auto& cpu : input_all.at("thread_cores").as_array()) {
+            cpus.push_back(static_cast<unsigned>(static_cast<double>(cpu)));
+        }
+        ThreadPlacement::pin_workers(cpus);
+    } else if (input_all.as_object().contains("thread_placement")) {
+        ThreadPlacement::pin_workers(
+            ThreadPlacement::cpus(ThreadPlacement::parse_policy(
+                input_all.at("thread_placement").as_string())));
+    }
     timer.start_timing("All");
 
     std::string output_filename = "output.json";
@@ -213,30 +701,115 @@ int main() {
 #endif
     result["run_time"] = util::get_date_string();
 
-    // scan_config["key"] = {head, step, tail, another_tail};
-    // another_tail is optional, depending on the input
-    std::unordered_map<std::string, std::array<double, 4>> scan_config;
+    // scan_config["key"] = {values from head to tail, values to another_tail}
+    // from {head, step, tail, another_tail}, another_tail is optional,
+    // depending on the input. A key given by {list} is scanned in order.
+    std::map<std::string, std::array<std::vector<double>, 2>> scan_config;
     for (auto& [key, val] : input_all.as_object()) {
         if (val.is_object()) {
-            auto iter = scan_config
-                            .emplace(key, std::array<double, 4>{val["head"],
-                                                                val["step"]})
-                            .first;
+            auto& branches = scan_config[key];
+            if (val.as_object().contains("list")) {
+                for (const auto& v : val["list"].as_array()) {
+                    branches[0].push_back(v);
+                }
+                continue;
+            }
+            std::array<double, 4> scan_para{val["head"], val["step"]};
             if (val["tail"].is_array()) {
-                iter->second[2] = val["tail"][0];
-                iter->second[3] = val["tail"][1];
+                scan_para[2] = val["tail"][0];
+                scan_para[3] = val["tail"][1];
             } else {
-                iter->second[2] = val["tail"];
-                iter->second[3] =
+                scan_para[2] = val["tail"];
+                scan_para[3] =
                     val["head"] +
                     .5 * std::copysign(val["step"], val["head"] - val["tail"]);
             }
+            auto get_scan_val = get_scan_generator(scan_para);
+            auto [cont, turning, scan_value] = get_scan_val();
+            std::size_t branch_idx = 0;
+            while (cont) {
+                if (turning) { branch_idx = 1; }
+                branches[branch_idx].push_back(scan_value);
+                std::tie(cont, turning, scan_value) = get_scan_val();
+            }
         }
     }
 
     result["result"] = Value::create_object();
     auto& result_object = result["result"].as_object();
 
+    // results are also appended to a file as they are solved, see
+    // ResultStream
+    std::optional<ResultStream> result_stream;
+    if (input_all.as_object().contains("output_stream")) {
+        std::size_t sync_interval = 1;
+        if (input_all.as_object().contains("output_stream_sync")) {
+            sync_interval = input_all.at("output_stream_sync");
+        }
+        result_stream.emplace(input_all.at("output_stream").as_string(),
+                              input_all, sync_interval);
+    }
+
+    // eigen matrices of all points go to one file when asked, see
+    // RecordContainer
+    std::optional<RecordContainer> record_container;
+    if (input_all.as_object().contains("eigen_matrix_container")) {
+        record_container.emplace(
+            input_all.at("eigen_matrix_container").as_string());
+    }
+
+    // Result of a point completed by a previous run, failed ones are tried
+    // again. Omega moves to its eigenvalue as if it is solved.
+    auto resume_point = [&](const std::string& scan_key,
+                            const Value& scan_value,
+                            std::complex<double>& omega) {
+        std::optional<Value> single_result;
+        if (result_stream) {
+            single_result = result_stream->completed(scan_key, scan_value);
+        }
+        if (single_result && single_result->at("eigenvalue").is_string()) {
+            single_result.reset();
+        }
+        if (single_result) {
+            const auto& eva = single_result->at("eigenvalue");
+            omega = {eva[0], eva[1]};
+            std::cout << "        Eigenvalue: " << omega << " (resumed)\n";
+            // as record_point does for solved points
+            auto& fields = single_result->as_object();
+            fields.erase("eigenvector");
+            fields.erase("eigenvectors");
+            // the record container is rewritten by this run, its record of
+            // the point is gone
+            if (record_container && fields.contains("eigenMatrix") &&
+                fields.at("eigenMatrix").is_string() &&
+                fields.at("eigenMatrix").as_string() ==
+                    record_container->file_name()) {
+                fields.erase("eigenMatrix");
+                fields.erase("eigenMatrix_record");
+            }
+        }
+        return single_result;
+    };
+
+    // Eigenvectors are only kept in result stream, output.json keeps the
+    // rest, so that memory does not grow with eigenvectors of every point
+    auto record_point = [&](const std::string& scan_key,
+                            const Value& scan_value, Value& single_result) {
+        if (!result_stream) { return; }
+        result_stream->append(scan_key, scan_value, single_result);
+        single_result.as_object().erase("eigenvector");
+        single_result.as_object().erase("eigenvectors");
+    };
+
+    auto open_dump = [&](const Value& input, std::string file_name,
+                         const std::string& scan_key,
+                         const Value& scan_value) {
+        if (record_container) {
+            return DumpOutput(input, *record_container, scan_key, scan_value);
+        }
+        return DumpOutput(input, std::move(file_name));
+    };
+
     if (scan_config.empty()) {
         // Do not need to scan any parameter
         auto result_unit = Value::create_object();
@@ -245,78 +818,559 @@ int main() {
             Value::create_array();
         std::cout << '\n';
 
-        auto eigen_matrix_file_name = "eigenMatrics/eigenMatrix.bin";
-        std::ofstream eigen_matrix_file(eigen_matrix_file_name,
-                                        std::ios::binary);
+        if (auto single_result =
+                resume_point("(None)", Value{}, omega_initial_guess)) {
+            scan_result_array.as_array().push_back(*std::move(single_result));
+        } else {
+            auto eigen_matrix_file =
+                open_dump(input_all, "eigenMatrics/eigenMatrix.bin", "(None)",
+                          Value{});
 
-        scan_result_array.as_array().push_back(
-            invoke_solver(input_all, omega_initial_guess, eigen_matrix_file));
+            auto new_result = invoke_solver(input_all, omega_initial_guess,
+                                            eigen_matrix_file);
+            record_point("(None)", Value{}, new_result);
+            scan_result_array.as_array().push_back(std::move(new_result));
+        }
         result_object["(None)"] = std::move(result_unit);
     } else {
-        auto omega = omega_initial_guess;
-        for (const auto& [key, scan_para] : scan_config) {
-            // for each parameter need to be scanned
-            auto input = filter_input(input_all);
-            auto get_scan_val = get_scan_generator(scan_para);
-            auto [cont, turning, scan_value] = get_scan_val();
-            auto result_unit = Value::create_object();
-            result_unit["scan_key"] = key;
-            auto& scan_value_array = result_unit["scan_values"] =
-                Value::create_array();
+        const bool scan_continuation =
+            input_all.as_object().contains("scan_continuation") &&
+            input_all.at("scan_continuation").as_boolean();
 
-            auto& scan_result_array = result_unit["scan_result"] =
-                Value::create_array();
-            std::cout << "\nScanning " << key << '\n';
-            while (cont) {
-                input[key] = scan_value;
-                scan_value_array.as_array().push_back(scan_value);
-
-                // begin to scan another direction
-                if (turning) {
-                    auto& new_omega = scan_result_array[0]["eigenvalue"];
-                    if (new_omega.is_string()) {
-                        // NaN
-                        omega = omega_initial_guess;
+        // Predictor-corrector continuation from the last converged point of
+        // the branch to scan_value, in sub-steps when Newton iteration needs
+        // too many iterations or fails. Only the requested scan value is
+        // recorded, eigen matrix file keeps the last solve.
+        auto solve_by_continuation =
+            [&](auto& input, const std::string& key, double scan_value,
+                std::complex<double>& omega, ScanContinuation& continuation,
+                DumpOutput& eigen_matrix_file) {
+                const int iteration_limit = input.at("iteration_step_limit");
+                if (continuation.empty()) {
+                    auto single_result =
+                        invoke_solver(input, omega, eigen_matrix_file);
+                    if (auto eva = converged_eigenvalue(single_result)) {
+                        continuation.push(scan_value, *eva);
+                    }
+                    return single_result;
+                }
+
+                double current = continuation.last_value();
+                const double full_step = scan_value - current;
+                while (true) {
+                    const double step = full_step * continuation.step_scale;
+                    const double next =
+                        std::abs(step) >= std::abs(scan_value - current)
+                            ? scan_value
+                            : current + step;
+                    if (next != scan_value) {
+                        std::cout << "      sub-step " << key << ":" << next
+                                  << '\n';
+                    }
+                    input[key] = next;
+                    auto omega_guess = continuation.predict(next);
+
+                    eigen_matrix_file.truncate();
+                    std::optional<Value> single_result;
+                    std::optional<std::complex<double>> eva;
+                    std::exception_ptr error;
+                    try {
+                        single_result = invoke_solver(input, omega_guess,
+                                                      eigen_matrix_file);
+                        eva = converged_eigenvalue(*single_result);
+                    } catch (const std::exception&) {
+                        error = std::current_exception();
+                    }
+
+                    if (eva) {
+                        continuation.push(next, *eva);
+                        double iteration_number = 0.;
+                        if (single_result->as_object().contains(
+                                "iteration_number")) {
+                            iteration_number =
+                                single_result->at("iteration_number");
+                        }
+                        if (iteration_number > iteration_limit / 2) {
+                            continuation.step_scale =
+                                std::max(continuation.step_scale / 2,
+                                         ScanContinuation::MIN_STEP_SCALE);
+                        } else if (iteration_number <= iteration_limit / 4) {
+                            continuation.step_scale =
+                                std::min(continuation.step_scale * 2, 1.);
+                        }
+                        if (next == scan_value) {
+                            omega = *eva;
+                            return *std::move(single_result);
+                        }
+                        current = next;
+                    } else if (continuation.step_scale >
+                               ScanContinuation::MIN_STEP_SCALE) {
+                        continuation.step_scale /= 2;
+                    } else if (next == scan_value && single_result) {
+                        // not converged, recorded as is like a plain scan
+                        return *std::move(single_result);
+                    } else if (error) {
+                        std::rethrow_exception(error);
                     } else {
-                        omega.real(new_omega[0]);
-                        omega.imag(new_omega[1]);
+                        std::ostringstream oss;
+                        oss << "Continuation failed at " << key << " = "
+                            << next << '.';
+                        throw std::runtime_error(oss.str());
                     }
                 }
+            };
+
+        // Solve scan values in order, each starts from the last one. Scan
+        // branches may run on their own threads, so each one has its own
+        // copy of input and result arrays.
+        auto scan_branch = [&](const std::string& key, ScanBranch& branch,
+                               std::size_t begin, std::size_t end,
+                               std::complex<double>& omega,
+                               ScanContinuation& continuation) {
+            auto input = filter_input(input_all);
+            for (auto idx = begin; idx < end; ++idx) {
+                const auto scan_value = branch.values[idx];
+                input[key] = scan_value;
+                branch.scan_values.as_array().push_back(scan_value);
 
                 std::cout << "    " << key << ":" << scan_value << '\n';
 
+                if (auto single_result =
+                        resume_point(key, scan_value, omega)) {
+                    if (auto eva = converged_eigenvalue(*single_result)) {
+                        continuation.push(scan_value, *eva);
+                    }
+                    branch.scan_results.as_array().push_back(
+                        *std::move(single_result));
+                    continue;
+                }
+
                 auto eigen_matrix_file_name = "eigenMatrics/" + key + "Eq" +
                                               std::to_string(scan_value) +
                                               ".bin";
-                std::ofstream eigen_matrix_file(eigen_matrix_file_name,
-                                                std::ios::binary);
+                auto eigen_matrix_file = open_dump(
+                    input, eigen_matrix_file_name, key, Value(scan_value));
                 try {
                     auto single_result =
-                        invoke_solver(input, omega, eigen_matrix_file);
-                    single_result["eigenMatrix"] =
-                        eigen_matrix_file
-                            ? eigen_matrix_file_name
-                            : "Can not open '" + eigen_matrix_file_name +
-                                  "' for write.";
+                        scan_continuation
+                            ? solve_by_continuation(input, key, scan_value,
+                                                    omega, continuation,
+                                                    eigen_matrix_file)
+                            : invoke_solver(input, omega, eigen_matrix_file);
+                    eigen_matrix_file.describe(single_result);
                     single_result["scan_value"] = scan_value;
-                    scan_result_array.as_array().push_back(
+                    record_point(key, scan_value, single_result);
+                    branch.scan_results.as_array().push_back(
                         std::move(single_result));
                 } catch (const std::exception& e) {
                     auto err_result = Value::create_object();
                     err_result["eigenvalue"] = "NaN";
                     err_result["reason"] = e.what();
-                    scan_result_array.as_array().push_back(
+                    record_point(key, scan_value, err_result);
+                    branch.scan_results.as_array().push_back(
                         std::move(err_result));
                     std::cerr << "        " << e.what() << '\n';
                 }
-                std::tie(cont, turning, scan_value) = get_scan_val();
             }
-            result_object[key] = std::move(result_unit);
-            // reset initial guess
-            omega = omega_initial_guess;
+        };
+
+        // Scan branches and keys are independent except that the second
+        // branch starts from head, they share the thread pool when run
+        // concurrently. PIC solver keeps static state, runs serially.
+        std::ptrdiff_t scan_concurrency = 1;
+        if (input_all.as_object().contains("scan_concurrency") &&
+            input_all.at("method").as_string() != "PIC") {
+            scan_concurrency = std::max<std::ptrdiff_t>(
+                1, static_cast<double>(input_all.at("scan_concurrency")));
+        }
+        const auto launch_policy =
+            scan_concurrency > 1 ? std::launch::async : std::launch::deferred;
+        std::counting_semaphore<> scan_slots(scan_concurrency);
+        const auto main_thread_id = std::this_thread::get_id();
+        // a slot is released even if func throws, as the other branch of
+        // the key may be waiting for one while the key waits for it
+        struct scan_slot {
+            std::counting_semaphore<>& slots;
+            explicit scan_slot(std::counting_semaphore<>& slots_)
+                : slots(slots_) {
+                slots.acquire();
+            }
+            ~scan_slot() { slots.release(); }
+            scan_slot(const scan_slot&) = delete;
+            scan_slot& operator=(const scan_slot&) = delete;
+        };
+        auto in_scan_slot = [&](auto func) {
+            {
+                scan_slot slot(scan_slots);
+                func();
+            }
+            // timer is per thread
+            if (std::this_thread::get_id() != main_thread_id) {
+                auto& thread_timer = Timer::get_timer();
+                timer.merge(thread_timer);
+                thread_timer.reset();
+            }
+        };
+
+        auto scan_key = [&](const std::string& key,
+                            std::array<ScanBranch, 2>& branches) {
+            auto& [first, second] = branches;
+            if (first.values.empty()) { return; }
+            auto omega = omega_initial_guess;
+            ScanContinuation continuation;
+            in_scan_slot([&]() {
+                scan_branch(key, first, 0, 1, omega, continuation);
+            });
+
+            // begin to scan another direction from head
+            auto omega_other = omega_initial_guess;
+            ScanContinuation continuation_other;
+            const auto& head_result = first.scan_results[0];
+            if (const auto& new_omega = head_result.at("eigenvalue");
+                !new_omega.is_string()) {
+                omega_other.real(new_omega[0]);
+                omega_other.imag(new_omega[1]);
+            }
+            if (auto head_omega = converged_eigenvalue(head_result)) {
+                continuation_other.push(first.values[0], *head_omega);
+            }
+            auto other = std::async(launch_policy, [&]() {
+                in_scan_slot([&]() {
+                    scan_branch(key, second, 0, second.values.size(),
+                                omega_other, continuation_other);
+                });
+            });
+            in_scan_slot([&]() {
+                scan_branch(key, first, 1, first.values.size(), omega,
+                            continuation);
+            });
+            other.get();
+        };
+
+        // Cartesian product of all scan keys. Each point is solved from a
+        // solved neighbour one step closer to the heads, found by moving
+        // the last key that differs from head; points sharing the neighbour
+        // are independent and solved by scan_concurrency workers.
+        auto scan_on_grid = [&]() {
+            std::vector<std::string> keys;
+            // values of each key in order along the axis, and head position
+            std::vector<std::vector<double>> axes;
+            std::vector<std::size_t> heads;
+            for (const auto& [key, branch_values] : scan_config) {
+                keys.push_back(key);
+                auto& axis = axes.emplace_back(branch_values[1].rbegin(),
+                                               branch_values[1].rend());
+                heads.push_back(axis.size());
+                axis.insert(axis.end(), branch_values[0].begin(),
+                            branch_values[0].end());
+            }
+            // axis of a scan branch given by {head, step, tail} goes from
+            // another_tail to tail, a list is already in order
+            std::size_t point_number = 1;
+            for (const auto& axis : axes) { point_number *= axis.size(); }
+            if (point_number == 0) { return; }
+
+            // last key runs fastest
+            auto point_index = [&](std::size_t flat) {
+                std::vector<std::size_t> idx(axes.size());
+                for (auto d = axes.size(); d-- > 0;) {
+                    idx[d] = flat % axes[d].size();
+                    flat /= axes[d].size();
+                }
+                return idx;
+            };
+            auto flat_index = [&](const std::vector<std::size_t>& idx) {
+                std::size_t flat = 0;
+                for (std::size_t d = 0; d < axes.size(); ++d) {
+                    flat = flat * axes[d].size() + idx[d];
+                }
+                return flat;
+            };
+
+            struct GridPoint {
+                std::size_t parent;
+                // key moved from parent
+                std::size_t axis;
+                std::vector<std::size_t> children;
+                Value result;
+            };
+            std::vector<GridPoint> points(point_number);
+            const auto root = flat_index(heads);
+            for (std::size_t flat = 0; flat < point_number; ++flat) {
+                auto idx = point_index(flat);
+                auto d = axes.size();
+                while (d-- > 0 && idx[d] == heads[d]) {}
+                if (d >= axes.size()) { continue; }
+                idx[d] += idx[d] < heads[d] ? 1 : -1;
+                points[flat].parent = flat_index(idx);
+                points[flat].axis = d;
+                points[points[flat].parent].children.push_back(flat);
+            }
+
+            std::string grid_key;
+            for (std::size_t d = 0; d < keys.size(); ++d) {
+                grid_key += (d == 0 ? "" : " x ") + keys[d];
+            }
+
+            auto solve_point = [&](std::size_t flat) {
+                auto input = filter_input(input_all);
+                const auto idx = point_index(flat);
+                auto& point = points[flat];
+                std::string eigen_matrix_file_name = "eigenMatrics/";
+                auto scan_value_array = Value::create_array();
+                std::ostringstream oss;
+                oss << "   ";
+                for (std::size_t d = 0; d < axes.size(); ++d) {
+                    const auto v = axes[d][idx[d]];
+                    input[keys[d]] = v;
+                    scan_value_array.as_array().push_back(v);
+                    oss << ' ' << keys[d] << ':' << v;
+                    eigen_matrix_file_name += (d == 0 ? "" : "_") + keys[d] +
+                                              "Eq" + std::to_string(v);
+                }
+                eigen_matrix_file_name += ".bin";
+                oss << '\n';
+                std::cout << oss.str();
+
+                // start from the solved neighbour, and with continuation
+                // from up to three solved points in line with it
+                auto omega = omega_initial_guess;
+                ScanContinuation continuation;
+                if (flat != root) {
+                    const auto& new_omega =
+                        points[point.parent].result.at("eigenvalue");
+                    if (!new_omega.is_string()) {
+                        omega.real(new_omega[0]);
+                        omega.imag(new_omega[1]);
+                    }
+                    std::vector<std::size_t> line;
+                    for (auto p = point.parent;
+                         line.size() < ScanContinuation::MAX_HISTORY;
+                         p = points[p].parent) {
+                        line.push_back(p);
+                        if (p == root || points[p].axis != point.axis) {
+                            break;
+                        }
+                    }
+                    for (auto p = line.rbegin(); p != line.rend(); ++p) {
+                        if (auto eva =
+                                converged_eigenvalue(points[*p].result)) {
+                            continuation.push(
+                                axes[point.axis][point_index(*p)[point.axis]],
+                                *eva);
+                        }
+                    }
+                }
+
+                if (auto single_result =
+                        resume_point(grid_key, scan_value_array, omega)) {
+                    point.result = *std::move(single_result);
+                    return;
+                }
+
+                auto eigen_matrix_file =
+                    open_dump(input, eigen_matrix_file_name, grid_key,
+                              scan_value_array);
+                try {
+                    auto single_result =
+                        scan_continuation
+                            ? solve_by_continuation(
+                                  input, keys[point.axis],
+                                  axes[point.axis][idx[point.axis]], omega,
+                                  continuation, eigen_matrix_file)
+                            : invoke_solver(input, omega, eigen_matrix_file);
+                    eigen_matrix_file.describe(single_result);
+                    single_result["scan_value"] = std::move(scan_value_array);
+                    record_point(grid_key, single_result.at("scan_value"),
+                                 single_result);
+                    point.result = std::move(single_result);
+                } catch (const std::exception& e) {
+                    auto err_result = Value::create_object();
+                    err_result["eigenvalue"] = "NaN";
+                    err_result["reason"] = e.what();
+                    err_result["scan_value"] = std::move(scan_value_array);
+                    record_point(grid_key, err_result.at("scan_value"),
+                                 err_result);
+                    point.result = std::move(err_result);
+                    std::cerr << "        " << e.what() << '\n';
+                }
+            };
+
+            // depth first, so that a worker keeps on its own chain
+            std::mutex ready_mutex;
+            std::condition_variable ready_cv;
+            std::vector<std::size_t> ready{root};
+            std::size_t unsolved = point_number;
+            // first error solve_point does not record itself, e.g. failing
+            // to write the result stream, rethrown once all workers stop
+            std::exception_ptr grid_error;
+            auto grid_worker = [&]() {
+                while (true) {
+                    std::size_t flat;
+                    {
+                        std::unique_lock lk(ready_mutex);
+                        ready_cv.wait(lk, [&]() {
+                            return !ready.empty() || unsolved == 0;
+                        });
+                        if (ready.empty()) { break; }
+                        flat = ready.back();
+                        ready.pop_back();
+                    }
+                    try {
+                        solve_point(flat);
+                    } catch (...) {
+                        // children go on from the initial guess
+                        auto& result = points[flat].result;
+                        if (!result.is_object()) {
+                            result = Value::create_object();
+                            result["eigenvalue"] = "NaN";
+                        }
+                        std::lock_guard lk(ready_mutex);
+                        if (!grid_error) {
+                            grid_error = std::current_exception();
+                        }
+                    }
+                    {
+                        std::lock_guard lk(ready_mutex);
+                        const auto& children = points[flat].children;
+                        ready.insert(ready.end(), children.rbegin(),
+                                     children.rend());
+                        --unsolved;
+                    }
+                    ready_cv.notify_all();
+                }
+                if (std::this_thread::get_id() != main_thread_id) {
+                    auto& thread_timer = Timer::get_timer();
+                    timer.merge(thread_timer);
+                    thread_timer.reset();
+                }
+            };
+
+            std::cout << "\nScanning " << grid_key << '\n';
+            {
+                std::vector<std::jthread> workers;
+                for (std::ptrdiff_t i = 1; i < scan_concurrency; ++i) {
+                    workers.emplace_back(grid_worker);
+                }
+                grid_worker();
+            }
+            if (grid_error) { std::rethrow_exception(grid_error); }
+
+            auto result_unit = Value::create_object();
+            auto& scan_key_array = result_unit["scan_key"] =
+                Value::create_array();
+            for (const auto& key : keys) {
+                scan_key_array.as_array().emplace_back() = key;
+            }
+            auto& scan_value_array = result_unit["scan_values"] =
+                Value::create_array();
+            auto& scan_result_array = result_unit["scan_result"] =
+                Value::create_array();
+            for (auto& point : points) {
+                scan_value_array.as_array().push_back(
+                    point.result.at("scan_value").clone());
+                scan_result_array.as_array().push_back(
+                    std::move(point.result));
+            }
+            result_object[grid_key] = std::move(result_unit);
+        };
+
+        const bool scan_grid =
+            input_all.as_object().contains("scan_grid") &&
+            input_all.at("scan_grid").as_boolean();
+        if (scan_grid) {
+            scan_on_grid();
+        } else {
+            // head and one tail, then the other tail
+            std::vector<std::pair<std::string, std::array<ScanBranch, 2>>> scans;
+            scans.reserve(scan_config.size());
+            for (const auto& [key, branch_values] : scan_config) {
+                auto& [scan_key_name, branches] = scans.emplace_back();
+                scan_key_name = key;
+                branches[0].values = branch_values[0];
+                branches[1].values = branch_values[1];
+            }
+
+            std::vector<std::future<void>> scan_futures;
+            for (auto& [key, branches] : scans) {
+                std::cout << "\nScanning " << key << '\n';
+                scan_futures.push_back(std::async(
+                    launch_policy, [&]() { scan_key(key, branches); }));
+                if (launch_policy == std::launch::deferred) {
+                    scan_futures.back().get();
+                }
+            }
+            for (auto& f : scan_futures) {
+                if (f.valid()) { f.get(); }
+            }
+
+            for (auto& [key, branches] : scans) {
+                auto result_unit = Value::create_object();
+                result_unit["scan_key"] = key;
+                auto& scan_value_array = result_unit["scan_values"] =
+                    std::move(branches[0].scan_values);
+                auto& scan_result_array = result_unit["scan_result"] =
+                    std::move(branches[0].scan_results);
+                for (auto& v : branches[1].scan_values.as_array()) {
+                    scan_value_array.as_array().push_back(std::move(v));
+                }
+                for (auto& r : branches[1].scan_results.as_array()) {
+                    scan_result_array.as_array().push_back(std::move(r));
+                }
+                result_object[key] = std::move(result_unit);
+            }
         }
     }
 
+    // counters of zones closed so far, summed over threads
+    if (PerfCounters::enabled()) {
+        auto& perf = result["perf_counters"] = Value::create_object();
+        for (const auto& zone : Timer::summary()) {
+            auto& entry = perf[zone.name] = Value::create_object();
+            entry["seconds"] = zone.seconds;
+            entry["count"] = static_cast<double>(zone.count);
+            for (std::size_t i = 0; i < PerfCounters::COUNTER_NUMBER; ++i) {
+                const auto counter = static_cast<PerfCounters::Counter>(i);
+                if (PerfCounters::available(counter)) {
+                    entry[PerfCounters::name(counter)] =
+                        static_cast<double>(zone.counters[i]);
+                }
+            }
+        }
+    }
+
+    // MiB of tagged allocations, and their peak while each zone closed so
+    // far was open, and how much of huge page blocks got huge pages
+    const auto huge_pages = HugePages::report();
+    {
+        auto& memory = result["memory"] = Value::create_object();
+        auto in_mib = [](std::size_t bytes) {
+            return static_cast<double>(bytes) / (1 << 20);
+        };
+        auto by_tag = [&](const MemoryAccount::bytes& bytes) {
+            auto entry = Value::create_object();
+            for (std::size_t i = 0; i < bytes.size(); ++i) {
+                entry[MemoryAccount::name(i)] = in_mib(bytes[i]);
+            }
+            return entry;
+        };
+        memory["peak"] = by_tag(MemoryAccount::peak());
+        memory["current"] = by_tag(MemoryAccount::current());
+        if (MemoryAccount::enabled()) {
+            auto& zones = memory["zones"] = Value::create_object();
+            for (const auto& zone : Timer::summary()) {
+                if (zone.count != 0) { zones[zone.name] = by_tag(zone.memory); }
+            }
+        }
+        auto& huge = memory["huge_pages"] = Value::create_object();
+        huge["policy"] = HugePages::name(HugePages::policy());
+        huge["mapped"] = in_mib(huge_pages.mapped);
+        huge["hugetlbfs"] = in_mib(huge_pages.hugetlbfs);
+        huge["transparent_advised"] = in_mib(huge_pages.transparent_advised);
+        huge["transparent_sampled"] = in_mib(huge_pages.transparent_sampled);
+        huge["transparent_backed"] = in_mib(huge_pages.transparent_backed);
+    }
+
     timer.start_timing("Output");
     std::ofstream output(output_filename);
     output << result.pretty_print();
@@ -325,7 +1379,32 @@ int main() {
     timer.pause_timing("All");
     std::cout << '\n';
     timer.print();
+    Timer::print_threads();
+    Timer::print_counters();
+    Timer::print_memory();
+    if (huge_pages.mapped != 0) {
+        std::cout << "\nHuge pages (" << HugePages::name(HugePages::policy())
+                  << "): " << (huge_pages.mapped >> 20)
+                  << " MiB mapped in 2 MiB pages, "
+                  << (huge_pages.hugetlbfs >> 20) << " MiB from hugetlbfs, "
+                  << (huge_pages.transparent_advised >> 20)
+                  << " MiB advised for transparent huge pages, of which "
+                  << (huge_pages.transparent_backed >> 20) << " of "
+                  << (huge_pages.transparent_sampled >> 20)
+                  << " MiB sampled got them.\n";
+    }
     std::cout << '\n';
 
+    if (input_all.as_object().contains("profile_trace")) {
+        const auto& trace_file = input_all.at("profile_trace").as_string();
+        if (Timer::write_trace(trace_file)) {
+            std::cout << "Profile trace is written to " << trace_file
+                      << ".\n";
+        } else {
+            std::cerr << "Can not write profile trace to " << trace_file
+                      << ".\n";
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,103 @@
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "RecordContainer.h"
+
+int main() {
+    const char* file_name = "./test_container.emd";
+    constexpr std::size_t n = 100;
+
+    auto append = [&](RecordContainer& container, int t, int step) {
+        std::vector<std::complex<double>> field(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            field[i] = {static_cast<double>(t), step + 0.5 * i};
+        }
+        RecordContainer::RecordHeader header{};
+        header.data_type = RecordContainer::DataType::complex128;
+        header.layout = RecordContainer::Layout::full;
+        header.rows = 1;
+        header.cols = n;
+        header.step = step;
+        header.scan_value_number = 1;
+        header.scan_value[0] = t;
+        header.data_size = sizeof(field[0]) * n;
+        return container.append(header, field.data());
+    };
+
+    // 4 threads of 8 steps, the last step discarded, a record left
+    // unfinished, and one record after them so that the end of the file is
+    // known
+    {
+        RecordContainer container(file_name);
+        std::vector<std::jthread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&, t]() {
+                for (int step = 0; step < 8; ++step) {
+                    auto idx = append(container, t, step);
+                    if (step == 7) { container.discard(idx); }
+                }
+            });
+        }
+        for (auto& w : writers) { w.join(); }
+        {
+            RecordContainer::RecordHeader header{};
+            header.data_size = sizeof(std::complex<double>) * n;
+            auto record = container.begin_record(header);
+            const std::complex<double> value{};
+            record.write(&value, sizeof(value));
+        }
+        append(container, 4, 0);
+    }
+
+    std::size_t failed = 0;
+    auto report = [&](const char* name, bool good) {
+        failed += !good;
+        std::cout << name << ": " << (good ? "ok" : "FAILED") << '\n';
+    };
+
+    auto check = [&](const char* name, const RecordContainerView& view,
+                     std::size_t record_number, bool recovered) {
+        std::size_t bad = 0;
+        std::size_t discarded = 0;
+        for (std::size_t r = 0; r < view.records().size(); ++r) {
+            const auto& header = view.records()[r];
+            discarded += header.flags & RecordContainer::DISCARDED;
+            const auto data = view.data<std::complex<double>>(r);
+            bad += reinterpret_cast<std::uintptr_t>(data) %
+                       RecordContainer::ALIGNMENT !=
+                   0;
+            for (std::size_t i = 0; i < header.cols; ++i) {
+                bad += data[i] != std::complex<double>{header.scan_value[0],
+                                                       header.step + 0.5 * i};
+            }
+        }
+        report(name, view.records().size() == record_number &&
+                         discarded == 5 && bad == 0 &&
+                         view.recovered() == recovered);
+    };
+
+    check("index", RecordContainerView(file_name), 34, false);
+
+    // lose index, trailer and part of the last record as a crashed run does
+    {
+        std::FILE* f = std::fopen(file_name, "r+b");
+        std::fseek(f, 0, SEEK_END);
+        const long length = std::ftell(f);
+        std::fclose(f);
+        std::vector<char> head(length - 64 - 34 * 256 - 100);
+        f = std::fopen(file_name, "rb");
+        std::fread(head.data(), 1, head.size(), f);
+        std::fclose(f);
+        f = std::fopen(file_name, "wb");
+        std::fwrite(head.data(), 1, head.size(), f);
+        std::fclose(f);
+    }
+    check("recovery", RecordContainerView(file_name), 33, true);
+
+    std::remove(file_name);
+    return failed == 0 ? 0 : 1;
+}
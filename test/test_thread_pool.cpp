@@ -0,0 +1,146 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <latch>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "DedicatedThreadPool.h"
+
+using pool_type = DedicatedThreadPool<void>;
+
+int main() {
+    constexpr std::size_t worker_num = 4;
+    auto& pool = pool_type::get_instance(worker_num);
+    std::size_t failed = 0;
+    auto report = [&](const char* name, bool good) {
+        failed += !good;
+        std::cout << name << ": " << (good ? "ok" : "FAILED") << '\n';
+    };
+
+    // tasks queued by tasks, loops in loops and reduce splitting recursively
+    {
+        std::vector<std::future<void>> futures;
+        std::atomic<long> queued_sum{};
+        for (int i = 0; i < 100; ++i) {
+            futures.push_back(pool.queue_task([&, i]() {
+                pool.parallel_for(0, 10, 1, [&](int b, int e) {
+                    for (int j = b; j < e; ++j) { queued_sum += i * 10 + j; }
+                });
+            }));
+        }
+        for (auto& f : futures) { f.get(); }
+
+        std::atomic<long> nested_sum{};
+        pool.parallel_for(0, 64, 1, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                pool.parallel_for(0, 64, 4, [&](int bb, int ee) {
+                    for (int j = bb; j < ee; ++j) { nested_sum += i * 64 + j; }
+                });
+            }
+        });
+        const long reduced = pool.parallel_reduce(
+            0L, 100000L, 7L, 0L,
+            [](long b, long e, long acc) {
+                for (auto i = b; i < e; ++i) { acc += i; }
+                return acc;
+            },
+            [](long l, long r) { return l + r; });
+        report("nested submission", queued_sum == 999 * 1000 / 2 &&
+                                        nested_sum == 4095L * 4096 / 2 &&
+                                        reduced == 99999L * 100000 / 2);
+    }
+
+    // pieces left in the queue of the caller are taken by idle workers
+    {
+        std::mutex mutex;
+        std::set<std::thread::id> ids;
+        pool.parallel_for(0, 64, 1, [&](int, int) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::lock_guard lk(mutex);
+            ids.insert(std::this_thread::get_id());
+        });
+        report("stealing", ids.size() > 1);
+    }
+
+    // the first exception comes out, and the pool goes on working
+    {
+        bool loop_thrown = false;
+        try {
+            pool.parallel_for(0, 1000, 1, [](int b, int) {
+                if (b == 517) { throw std::runtime_error("loop"); }
+            });
+        } catch (const std::runtime_error& e) {
+            loop_thrown = e.what() == std::string("loop");
+        }
+        bool worker_thrown = false;
+        try {
+            pool.for_each_worker([](std::size_t w) {
+                if (w == worker_num - 1) { throw std::runtime_error("worker"); }
+            });
+        } catch (const std::runtime_error&) { worker_thrown = true; }
+        bool future_thrown = false;
+        auto future =
+            pool.queue_task([]() { throw std::runtime_error("future"); });
+        try {
+            future.get();
+        } catch (const std::runtime_error&) { future_thrown = true; }
+        std::atomic<int> after{};
+        pool.parallel_for(0, 100, 1, [&](int b, int e) { after += e - b; });
+        report("exceptions",
+               loop_thrown && worker_thrown && future_thrown && after == 100);
+    }
+
+    // more submitting threads at once than submitter slots (64), the rest go
+    // to the locked main queue
+    {
+        constexpr int submitter_num = 80;
+        std::latch all_alive(submitter_num);
+        std::atomic<long> sum{};
+        std::vector<std::thread> submitters;
+        for (int s = 0; s < submitter_num; ++s) {
+            submitters.emplace_back([&, s]() {
+                all_alive.arrive_and_wait();
+                std::vector<std::future<void>> futures;
+                for (int i = 0; i < 20; ++i) {
+                    futures.push_back(pool.queue_task([&, s]() { sum += s; }));
+                }
+                pool.parallel_for(0, 20, 1, [&](int b, int e) {
+                    sum += static_cast<long>(e - b) * s;
+                });
+                for (auto& f : futures) { f.get(); }
+            });
+        }
+        for (auto& t : submitters) { t.join(); }
+        report("many submitters",
+               sum == 40L * (submitter_num - 1) * submitter_num / 2);
+    }
+
+    // every worker runs once, on a thread of its own, and blocks cover range
+    {
+        std::mutex mutex;
+        std::vector<int> runs(worker_num);
+        std::set<std::thread::id> ids;
+        pool.for_each_worker([&](std::size_t w) {
+            std::lock_guard lk(mutex);
+            ++runs[w];
+            ids.insert(std::this_thread::get_id());
+        });
+        bool covered = pool.worker_block(0, 10, 0).first == 0 &&
+                       pool.worker_block(0, 10, worker_num - 1).second == 10;
+        for (std::size_t w = 1; w < worker_num; ++w) {
+            covered = covered && pool.worker_block(0, 10, w).first ==
+                                     pool.worker_block(0, 10, w - 1).second;
+        }
+        report("for each worker",
+               runs == std::vector<int>(worker_num, 1) &&
+                   ids.size() == worker_num &&
+                   !ids.contains(std::this_thread::get_id()) && covered);
+    }
+
+    return failed == 0 ? 0 : 1;
+}